@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+#include "archive_index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_SUFFIX ".idx"
+#define INDEX_MAGIC "MTARIDX7"
+#define INITIAL_CAPACITY 64
+
+// Layout of an index file: this header, 'count' index_entry_t records, 'frame_count'
+// index_frame_t records, 'count' uint32_t member numbers in name order, then 'names_size'
+// bytes of null-terminated names. Fields are
+// native-endian since the index is a local cache of the archive, not an interchange format.
+// The stamp fields describe the archive the index was written for.
+typedef struct {
+    char magic[8];
+    uint64_t archive_size;
+    int64_t archive_mtime_sec;
+    int64_t archive_mtime_nsec;
+    uint64_t archive_ino;
+    uint64_t count;
+    uint64_t names_size;
+    uint64_t frame_count;
+} index_file_header_t;
+
+// Builds The Path Of The Index File Belonging To 'archive_name'.
+static int index_path(const char *archive_name, char *path, size_t path_len) {
+    if (snprintf(path, path_len, "%s%s", archive_name, INDEX_SUFFIX) >= path_len) {
+        fprintf(stderr, "Archive name too long for index: %s\n", archive_name);
+        return -1;
+    }
+    return 0;
+}
+
+// Fills In The Stamp Fields Of 'file_header' From The Archive's Current Metadata.
+static int stamp_archive(const char *archive_name, index_file_header_t *file_header) {
+    struct stat stat_buf;
+    if (stat(archive_name, &stat_buf) != 0) {
+        perror("Failed to stat tar archive");
+        return -1;
+    }
+    file_header->archive_size = stat_buf.st_size;
+    file_header->archive_mtime_sec = stat_buf.st_mtim.tv_sec;
+    file_header->archive_mtime_nsec = stat_buf.st_mtim.tv_nsec;
+    file_header->archive_ino = stat_buf.st_ino;
+    return 0;
+}
+
+void archive_index_init(archive_index_t *index) {
+    memset(index, 0, sizeof(archive_index_t));
+}
+
+// Moves A Loaded Index Out Of Its File Block Into Growable Arrays, So It Can Be Added To.
+static int index_make_owned(archive_index_t *index) {
+    index_entry_t *entries = malloc((index->count + INITIAL_CAPACITY) * sizeof(index_entry_t));
+    char *names = malloc(index->names_size + INITIAL_CAPACITY);
+    index_frame_t *frames = malloc((index->frame_count + INITIAL_CAPACITY) * sizeof(index_frame_t));
+    if (entries == NULL || names == NULL || frames == NULL) {
+        free(entries);
+        free(names);
+        free(frames);
+        return -1;
+    }
+
+    memcpy(entries, index->entries, index->count * sizeof(index_entry_t));
+    memcpy(names, index->names, index->names_size);
+    memcpy(frames, index->frames, index->frame_count * sizeof(index_frame_t));
+    free(index->file_data);
+    index->file_data = NULL;
+    // The Name Order Is Not Kept Up As Members Are Added; It Is Worked Out Again On Saving.
+    index->sorted = NULL;
+    index->entries = entries;
+    index->capacity = index->count + INITIAL_CAPACITY;
+    index->names = names;
+    index->names_capacity = index->names_size + INITIAL_CAPACITY;
+    index->frames = frames;
+    index->frame_capacity = index->frame_count + INITIAL_CAPACITY;
+    return 0;
+}
+
+int archive_index_add(archive_index_t *index, const char *name, const index_entry_t *entry) {
+    if (index->file_data != NULL && index_make_owned(index) != 0) {
+        return -1;
+    }
+
+    if (index->count == index->capacity) {
+        size_t capacity = index->capacity == 0 ? INITIAL_CAPACITY : index->capacity * 2;
+        index_entry_t *entries = realloc(index->entries, capacity * sizeof(index_entry_t));
+        if (entries == NULL) {
+            return -1;
+        }
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+
+    size_t name_len = strlen(name) + 1;
+    if (index->names_size + name_len > UINT32_MAX) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+    if (index->names_size + name_len > index->names_capacity) {
+        size_t capacity = index->names_capacity == 0 ? INITIAL_CAPACITY : index->names_capacity;
+        while (capacity < index->names_size + name_len) {
+            capacity *= 2;
+        }
+        char *names = realloc(index->names, capacity);
+        if (names == NULL) {
+            return -1;
+        }
+        index->names = names;
+        index->names_capacity = capacity;
+    }
+
+    index_entry_t *new_entry = &index->entries[index->count++];
+    *new_entry = *entry;
+    new_entry->name_offset = index->names_size;
+    memcpy(index->names + index->names_size, name, name_len);
+    index->names_size += name_len;
+    return 0;
+}
+
+int archive_index_add_frame(archive_index_t *index, uint64_t compressed_offset, uint64_t offset) {
+    if (index->file_data != NULL && index_make_owned(index) != 0) {
+        return -1;
+    }
+
+    if (index->frame_count == index->frame_capacity) {
+        size_t capacity = index->frame_capacity == 0 ? INITIAL_CAPACITY : index->frame_capacity * 2;
+        index_frame_t *frames = realloc(index->frames, capacity * sizeof(index_frame_t));
+        if (frames == NULL) {
+            return -1;
+        }
+        index->frames = frames;
+        index->frame_capacity = capacity;
+    }
+    index->frames[index->frame_count].compressed_offset = compressed_offset;
+    index->frames[index->frame_count].offset = offset;
+    index->frame_count++;
+    return 0;
+}
+
+const index_frame_t *archive_index_find_frame(const archive_index_t *index, uint64_t offset) {
+    // Frames Are In Archive Order, So Binary Search For The Last One Starting By 'offset'.
+    size_t low = 0;
+    size_t high = index->frame_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (index->frames[mid].offset <= offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low > 0 ? &index->frames[low - 1] : NULL;
+}
+
+const char *archive_index_name(const archive_index_t *index, size_t i) {
+    return index->names + index->entries[i].name_offset;
+}
+
+// Returns The First Position In The Index's Name Order Whose Name, Cut Off After 'len'
+// Bytes, Compares Greater Than 'prefix' (Or Greater Or Equal, Unless 'after' Is Set).
+static size_t sorted_bound(const archive_index_t *index, const char *prefix, size_t len,
+                           int after) {
+    size_t low = 0;
+    size_t high = index->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int cmp = strncmp(archive_index_name(index, index->sorted[mid]), prefix, len);
+        if (cmp < 0 || (after && cmp == 0)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+void archive_index_prefix_range(const archive_index_t *index, const char *prefix, size_t len,
+                                size_t *first, size_t *end) {
+    *first = sorted_bound(index, prefix, len, 0);
+    *end = sorted_bound(index, prefix, len, 1);
+}
+
+long archive_index_find_newest(const archive_index_t *index, const char *name) {
+    // Equal Names Sit Together In Archive Order, So The Newest Is The Last Of Them.
+    size_t len = strlen(name) + 1;
+    size_t end = sorted_bound(index, name, len, 1);
+    if (end == 0 || strcmp(archive_index_name(index, index->sorted[end - 1]), name) != 0) {
+        return -1;
+    }
+    return index->sorted[end - 1];
+}
+
+int archive_index_load(archive_index_t *index, const char *archive_name) {
+    archive_index_init(index);
+
+    char path[PATH_MAX];
+    if (index_path(archive_name, path, PATH_MAX) != 0) {
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            return 1;
+        }
+        perror("Failed to open archive index");
+        return -1;
+    }
+
+    // The Whole Index Is Pulled In With One Read (Short Reads Are Retried).
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) != 0) {
+        perror("Failed to stat archive index");
+        close(fd);
+        return -1;
+    }
+    size_t file_size = stat_buf.st_size;
+    if (file_size < sizeof(index_file_header_t)) {
+        close(fd);
+        return 1;
+    }
+    char *data = malloc(file_size);
+    if (data == NULL) {
+        perror("Failed to allocate archive index");
+        close(fd);
+        return -1;
+    }
+    size_t bytes_read = 0;
+    while (bytes_read < file_size) {
+        ssize_t n = read(fd, data + bytes_read, file_size - bytes_read);
+        if (n <= 0) {
+            if (n < 0) {
+                perror("Failed to read archive index");
+            }
+            free(data);
+            close(fd);
+            return n < 0 ? -1 : 1;
+        }
+        bytes_read += n;
+    }
+    close(fd);
+
+    // The Index Only Counts If It Was Written For The Archive As It Is Right Now.
+    index_file_header_t stamp;
+    if (stamp_archive(archive_name, &stamp) != 0) {
+        free(data);
+        return -1;
+    }
+    const index_file_header_t *file_header = (const index_file_header_t *) data;
+    int valid = memcmp(file_header->magic, INDEX_MAGIC, sizeof(file_header->magic)) == 0 &&
+                file_header->archive_size == stamp.archive_size &&
+                file_header->archive_mtime_sec == stamp.archive_mtime_sec &&
+                file_header->archive_mtime_nsec == stamp.archive_mtime_nsec &&
+                file_header->archive_ino == stamp.archive_ino &&
+                file_header->count <= file_size / sizeof(index_entry_t) &&
+                file_header->frame_count <= file_size / sizeof(index_frame_t) &&
+                sizeof(index_file_header_t) + file_header->count * sizeof(index_entry_t) +
+                        file_header->frame_count * sizeof(index_frame_t) +
+                        file_header->count * sizeof(uint32_t) + file_header->names_size ==
+                    file_size;
+    if (!valid) {
+        free(data);
+        return 1;
+    }
+
+    index->file_data = data;
+    index->entries = (index_entry_t *) (data + sizeof(index_file_header_t));
+    index->count = file_header->count;
+    index->frames = (index_frame_t *) (index->entries + index->count);
+    index->frame_count = file_header->frame_count;
+    index->sorted = (uint32_t *) (index->frames + index->frame_count);
+    index->names = (char *) (index->sorted + index->count);
+    index->names_size = file_header->names_size;
+
+    // Guard Against A Corrupt Index Pointing Names Outside The Pool, Or Past Its Members.
+    for (size_t i = 0; i < index->count; i++) {
+        if (index->entries[i].name_offset >= index->names_size ||
+            index->sorted[i] >= index->count) {
+            archive_index_clear(index);
+            return 1;
+        }
+    }
+    if (index->names_size > 0 && index->names[index->names_size - 1] != '\0') {
+        archive_index_clear(index);
+        return 1;
+    }
+    return 0;
+}
+
+// Orders Member Numbers By Name, And Members Sharing A Name By Their Place In The Archive.
+static int compare_members(const void *a, const void *b, void *arg) {
+    const archive_index_t *index = arg;
+    uint32_t member_a = *(const uint32_t *) a;
+    uint32_t member_b = *(const uint32_t *) b;
+    int cmp = strcmp(archive_index_name(index, member_a), archive_index_name(index, member_b));
+    if (cmp != 0) {
+        return cmp;
+    }
+    return member_a < member_b ? -1 : member_a > member_b;
+}
+
+int archive_index_save(const archive_index_t *index, const char *archive_name) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX + 4];
+    if (index_path(archive_name, path, PATH_MAX) != 0) {
+        return -1;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    index_file_header_t file_header;
+    memset(&file_header, 0, sizeof(index_file_header_t));
+    memcpy(file_header.magic, INDEX_MAGIC, sizeof(file_header.magic));
+    if (stamp_archive(archive_name, &file_header) != 0) {
+        return -1;
+    }
+    file_header.count = index->count;
+    file_header.names_size = index->names_size;
+    file_header.frame_count = index->frame_count;
+
+    // Members Are Numbered In 32 Bits, Like The Offsets Into The Name Pool.
+    if (index->count > UINT32_MAX) {
+        errno = EOVERFLOW;
+        perror("Failed to write archive index");
+        return -1;
+    }
+    // An Empty Archive Gets An Index With No Entries, Order Or Names, Just The Header.
+    uint32_t *sorted = NULL;
+    if (index->count > 0) {
+        sorted = malloc(index->count * sizeof(uint32_t));
+        if (sorted == NULL) {
+            perror("Failed to allocate archive index");
+            return -1;
+        }
+        for (size_t i = 0; i < index->count; i++) {
+            sorted[i] = i;
+        }
+        qsort_r(sorted, index->count, sizeof(uint32_t), compare_members, (void *) index);
+    }
+
+    // Write To A Temporary File And Rename It, So Readers Never See A Partial Index.
+    FILE *index_file = fopen(tmp_path, "wb");
+    if (index_file == NULL) {
+        perror("Failed to create archive index");
+        free(sorted);
+        return -1;
+    }
+    if (fwrite(&file_header, sizeof(index_file_header_t), 1, index_file) != 1 ||
+        (index->count > 0 &&
+         fwrite(index->entries, sizeof(index_entry_t), index->count, index_file) !=
+             index->count) ||
+        (index->frame_count > 0 &&
+         fwrite(index->frames, sizeof(index_frame_t), index->frame_count, index_file) !=
+             index->frame_count) ||
+        (index->count > 0 &&
+         fwrite(sorted, sizeof(uint32_t), index->count, index_file) != index->count) ||
+        (index->names_size > 0 &&
+         fwrite(index->names, 1, index->names_size, index_file) != index->names_size)) {
+        perror("Failed to write archive index");
+        fclose(index_file);
+        unlink(tmp_path);
+        free(sorted);
+        return -1;
+    }
+    free(sorted);
+    if (fclose(index_file) != 0) {
+        perror("Failed to close archive index");
+        unlink(tmp_path);
+        return -1;
+    }
+    if (rename(tmp_path, path) != 0) {
+        perror("Failed to rename archive index");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+void archive_index_remove(const char *archive_name) {
+    char path[PATH_MAX];
+    if (index_path(archive_name, path, PATH_MAX) == 0) {
+        unlink(path);
+    }
+}
+
+void archive_index_clear(archive_index_t *index) {
+    if (index->file_data != NULL) {
+        free(index->file_data);
+    } else {
+        free(index->entries);
+        free(index->names);
+        free(index->frames);
+    }
+    archive_index_init(index);
+}
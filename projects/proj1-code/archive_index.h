@@ -0,0 +1,113 @@
+#ifndef _ARCHIVE_INDEX_H
+#define _ARCHIVE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// One member of an archive, as recorded in its index
+typedef struct {
+    // Offset of the member's (ustar) header block within the archive
+    uint64_t header_offset;
+    // Size of the member's contents in bytes, as stored in the archive
+    uint64_t size;
+    // Modification time of the member in Unix epoch time
+    int64_t mtime;
+    // Checksum stored in the member's header
+    uint32_t chksum;
+    // Permission bits of the member
+    uint32_t mode;
+    // Offset of the member's null-terminated name within the index's name pool
+    uint32_t name_offset;
+    // Type of the member, the typeflag byte of its header
+    uint32_t typeflag;
+    // Bytes of extended headers (e.g. a PAX header holding a long name) just in front of
+    // the member's header, so the member starts at 'header_offset - ext_size'
+    uint32_t ext_size;
+    // INDEX_SPARSE if the member is a sparse file, whose contents are a sparse map followed
+    // by only the file's data
+    uint32_t flags;
+    // Size of the file the member extracts to, which is larger than 'size' for a sparse
+    // member that has holes
+    uint64_t real_size;
+} index_entry_t;
+
+#define INDEX_SPARSE 0x1
+
+// Start of one independently compressed frame of a compressed archive, as recorded in its
+// index, so a member can be reached by decompressing from the frame holding its header
+typedef struct {
+    // Offset of the frame within the compressed file
+    uint64_t compressed_offset;
+    // Offset within the archive of the first byte the frame holds
+    uint64_t offset;
+} index_frame_t;
+
+// Member index of an archive, in archive order, kept in a sidecar file next to it
+// ("ARCHIVE.idx") so listing and lookups do not have to walk every header
+typedef struct {
+    index_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    char *names;
+    size_t names_size;
+    size_t names_capacity;
+    // Frames of a compressed archive in archive order, if known (there are none for an
+    // uncompressed one)
+    index_frame_t *frames;
+    size_t frame_count;
+    size_t frame_capacity;
+    // Member numbers ordered by name, with members sharing a name in archive order, so a
+    // name or a prefix can be looked up without going through every member. Only present
+    // while the index is as loaded from disk; it is NULL otherwise.
+    uint32_t *sorted;
+    // Block read from disk that 'entries', 'frames', 'sorted' and 'names' point into, if
+    // the index was loaded
+    void *file_data;
+} archive_index_t;
+
+// Initialize a new, empty index
+void archive_index_init(archive_index_t *index);
+
+// Add a member named 'name' to the end of the index, copying its other fields from 'entry'
+// Returns 0 on success or -1 if an error occurs
+int archive_index_add(archive_index_t *index, const char *name, const index_entry_t *entry);
+
+// Add a frame starting at 'compressed_offset' in a compressed archive, holding the archive
+// from 'offset' on, to the end of the index's frames
+// Returns 0 on success or -1 if an error occurs
+int archive_index_add_frame(archive_index_t *index, uint64_t compressed_offset, uint64_t offset);
+
+// Returns the last frame of the index starting at or before 'offset' in the archive, or
+// NULL if there is none
+const index_frame_t *archive_index_find_frame(const archive_index_t *index, uint64_t offset);
+
+// Returns the name of the index's i-th member
+const char *archive_index_name(const archive_index_t *index, size_t i);
+
+// Find the members whose names start with the first 'len' bytes of 'prefix', which are
+// 'sorted[*first]' up to (not including) 'sorted[*end]'. Needs the index's name order.
+void archive_index_prefix_range(const archive_index_t *index, const char *prefix, size_t len,
+                                size_t *first, size_t *end);
+
+// Returns the member number of the newest member named exactly 'name', or -1 if there is
+// none. Needs the index's name order.
+long archive_index_find_newest(const archive_index_t *index, const char *name);
+
+// Load the index of the archive named 'archive_name' with a single read
+// Returns 0 on success, 1 if there is no index or it does not match the archive's current
+// contents (it is stale), or -1 if an error occurs
+int archive_index_load(archive_index_t *index, const char *archive_name);
+
+// Write 'index' as the index of the archive named 'archive_name'
+// Must be called once the archive is complete and closed, as the index is stamped with the
+// archive's current size and modification time
+// Returns 0 on success or -1 if an error occurs
+int archive_index_save(const archive_index_t *index, const char *archive_name);
+
+// Delete the index of the archive named 'archive_name', if there is one
+void archive_index_remove(const char *archive_name);
+
+// Free any memory associated with the index and leave it empty
+void archive_index_clear(archive_index_t *index);
+
+#endif    // _ARCHIVE_INDEX_H
@@ -0,0 +1,92 @@
+#include "block_checksum.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#define CHECKSUM_BLOCK_SIZE 512
+
+// Signed sum of a block whose bytes all read as 0, once every byte is biased by 0x80
+#define SIGNED_BIAS (128 * CHECKSUM_BLOCK_SIZE)
+
+typedef void (*checksum_kernel_t)(const unsigned char *block, block_sums_t *sums);
+
+static void checksum_scalar(const unsigned char *block, block_sums_t *sums) {
+    int signed_sum = 0;
+    unsigned unsigned_sum = 0;
+    for (int i = 0; i < CHECKSUM_BLOCK_SIZE; i++) {
+        signed_sum += (signed char) block[i];
+        unsigned_sum += block[i];
+    }
+    sums->signed_sum = signed_sum;
+    sums->unsigned_sum = unsigned_sum;
+}
+
+#ifdef HAVE_X86_KERNELS
+// Both kernels rely on psadbw against zero, which adds up groups of 8 unsigned bytes.
+// Flipping the top bit of every byte maps a signed char c to c + 128, so the signed sum is
+// the sum of the flipped bytes minus SIGNED_BIAS.
+
+__attribute__((target("sse2"))) static void checksum_sse2(const unsigned char *block,
+                                                           block_sums_t *sums) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i flip = _mm_set1_epi8((char) 0x80);
+    __m128i unsigned_acc = zero;
+    __m128i flipped_acc = zero;
+    for (int i = 0; i < CHECKSUM_BLOCK_SIZE; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (block + i));
+        unsigned_acc = _mm_add_epi64(unsigned_acc, _mm_sad_epu8(bytes, zero));
+        flipped_acc = _mm_add_epi64(flipped_acc, _mm_sad_epu8(_mm_xor_si128(bytes, flip), zero));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, unsigned_acc);
+    sums->unsigned_sum = lanes[0] + lanes[1];
+    _mm_storeu_si128((__m128i *) lanes, flipped_acc);
+    sums->signed_sum = (int) (lanes[0] + lanes[1]) - SIGNED_BIAS;
+}
+
+__attribute__((target("avx2"))) static void checksum_avx2(const unsigned char *block,
+                                                           block_sums_t *sums) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i flip = _mm256_set1_epi8((char) 0x80);
+    __m256i unsigned_acc = zero;
+    __m256i flipped_acc = zero;
+    for (int i = 0; i < CHECKSUM_BLOCK_SIZE; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) (block + i));
+        unsigned_acc = _mm256_add_epi64(unsigned_acc, _mm256_sad_epu8(bytes, zero));
+        flipped_acc =
+            _mm256_add_epi64(flipped_acc, _mm256_sad_epu8(_mm256_xor_si256(bytes, flip), zero));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, unsigned_acc);
+    sums->unsigned_sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256((__m256i *) lanes, flipped_acc);
+    sums->signed_sum = (int) (lanes[0] + lanes[1] + lanes[2] + lanes[3]) - SIGNED_BIAS;
+}
+#endif
+
+static checksum_kernel_t checksum_kernel = checksum_scalar;
+static pthread_once_t checksum_kernel_once = PTHREAD_ONCE_INIT;
+
+// Picks the widest kernel the running CPU supports
+static void select_checksum_kernel(void) {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        checksum_kernel = checksum_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        checksum_kernel = checksum_sse2;
+    }
+#endif
+}
+
+void block_checksum(const void *block, block_sums_t *sums) {
+    pthread_once(&checksum_kernel_once, select_checksum_kernel);
+    checksum_kernel(block, sums);
+}
@@ -0,0 +1,16 @@
+#ifndef _BLOCK_CHECKSUM_H
+#define _BLOCK_CHECKSUM_H
+
+// Byte sums of one 512-byte tar block
+typedef struct {
+    // Bytes summed as signed chars, the way minitar (and old tar implementations) write it
+    int signed_sum;
+    // Bytes summed as unsigned chars, the way POSIX specifies it
+    unsigned unsigned_sum;
+} block_sums_t;
+
+// Sums the 512 bytes at 'block' into 'sums'
+// Uses an AVX2 or SSE2 kernel when the CPU has one, picked on first use, or plain C otherwise
+void block_checksum(const void *block, block_sums_t *sums);
+
+#endif    // _BLOCK_CHECKSUM_H
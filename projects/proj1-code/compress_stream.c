@@ -0,0 +1,931 @@
+#define _GNU_SOURCE
+#include "compress_stream.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Chunks in flight per thread working on a stage, so each always has one to fill or empty
+#define CHUNKS_PER_THREAD 2
+#define MIN_CHUNKS 4
+// Size of a chunk, and so of the uncompressed data in each frame
+#define CHUNK_SIZE (1 << 20)
+#define INITIAL_FRAMES 64
+// zlib's window size, plus 16 to ask for a gzip wrapper rather than a zlib one
+#define GZIP_WINDOW_BITS (15 + 16)
+#define GZIP_MEM_LEVEL 8
+// Room for the largest footer frame: a gzip member holding a single stored block
+#define MAX_FOOTER_FRAME (COMPRESS_FOOTER_SIZE + 32)
+
+static const unsigned char gzip_magic[] = {0x1f, 0x8b};
+static const unsigned char zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+// A run of uncompressed data passed between the caller and the worker thread
+typedef struct {
+    char *data;
+    size_t len;
+    size_t pos;    // Bytes the reader has already handed out
+    int last;      // Set on the final chunk of the data
+} chunk_t;
+
+// The library's state for compressing or decompressing
+typedef struct {
+    z_stream zstream;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+#endif
+} codec_t;
+
+typedef struct compress_stream compress_stream_t;
+
+// One of the threads of a writing stage, compressing whole chunks into frames of their own
+typedef struct {
+    compress_stream_t *cs;
+    pthread_t thread;
+    int started;
+    codec_t codec;
+    char *frame;    // The compressed frame of the chunk being worked on
+    size_t frame_capacity;
+} frame_worker_t;
+
+// One compression (writing) or decompression (reading) stage.
+// The caller and the worker threads pass chunks through a ring: whichever side produces
+// uncompressed data fills the chunk after the last full one, and the other side empties the
+// full ones, so compression overlaps with whatever the caller is doing.
+// When writing, each chunk becomes a frame. The workers claim full chunks in order and
+// compress them at the same time, then take turns (in chunk order) writing the frames out.
+struct compress_stream {
+    compress_type_t type;
+    int fd;
+    int writing;
+    pthread_t thread;              // Reading: the decompression thread
+    frame_worker_t *workers;       // Writing: the compression threads
+    int num_workers;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    chunk_t *chunks;
+    size_t num_chunks;
+    size_t head;                   // Oldest full chunk
+    size_t count;                  // Full chunks waiting to be emptied
+    uint64_t head_seq;             // Writing: number of chunks written out before 'head'
+    uint64_t next_claim;           // Writing: number of the next chunk for a worker to claim
+    int closing;                   // Writing: the last chunk has been claimed
+    int abort;                     // Set by the caller to stop the workers early
+    int failed;                    // Set by a worker if it gives up
+    off_t position;                // Uncompressed bytes written or read so far
+    off_t frame_offset;            // Writing: uncompressed offset of the next frame
+    off_t compressed_offset;       // Position in 'fd' of the next compressed byte
+    compress_frame_table_t *frames;
+    char *io_buf;                  // Reading: compressed data on its way from 'fd'
+    codec_t codec;                 // Reading: the decompressor
+    int pipe;                      // Reading: 'fd' cannot seek, so it is read in order
+    unsigned char peeked[sizeof(zstd_magic)];    // Reading: bytes already taken off the pipe
+    size_t peeked_len;
+};
+
+void compress_frame_table_init(compress_frame_table_t *table) {
+    memset(table, 0, sizeof(compress_frame_table_t));
+}
+
+void compress_frame_table_clear(compress_frame_table_t *table) {
+    free(table->frames);
+    compress_frame_table_init(table);
+}
+
+// Appends The Start Of A Frame To The Table, Growing It As Needed.
+static int frame_table_add(compress_frame_table_t *table, uint64_t compressed_offset,
+                           uint64_t offset) {
+    if (table->count == table->capacity) {
+        size_t capacity = table->capacity == 0 ? INITIAL_FRAMES : table->capacity * 2;
+        compress_frame_t *frames = realloc(table->frames, capacity * sizeof(compress_frame_t));
+        if (frames == NULL) {
+            perror("Failed to allocate frame table");
+            return -1;
+        }
+        table->frames = frames;
+        table->capacity = capacity;
+    }
+    table->frames[table->count].compressed_offset = compressed_offset;
+    table->frames[table->count].offset = offset;
+    table->count++;
+    return 0;
+}
+
+int compress_available(compress_type_t type) {
+#ifdef HAVE_ZSTD
+    return 1;
+#else
+    return type != COMPRESS_ZSTD;
+#endif
+}
+
+// Works Out The Compression Of Data Starting With The 'magic_len' Bytes At 'magic'.
+static compress_type_t detect_magic(const unsigned char *magic, size_t magic_len) {
+    if (magic_len >= sizeof(gzip_magic) && memcmp(magic, gzip_magic, sizeof(gzip_magic)) == 0) {
+        return COMPRESS_GZIP;
+    } else if (magic_len >= sizeof(zstd_magic) &&
+               memcmp(magic, zstd_magic, sizeof(zstd_magic)) == 0) {
+        return COMPRESS_ZSTD;
+    }
+    return COMPRESS_NONE;
+}
+
+int compress_detect(int fd, compress_type_t *type) {
+    unsigned char magic[sizeof(zstd_magic)];
+    ssize_t magic_len = pread(fd, magic, sizeof(magic), 0);
+    if (magic_len < 0) {
+        perror("Failed to read from tar archive");
+        return -1;
+    }
+    *type = detect_magic(magic, magic_len);
+    return 0;
+}
+
+// Builds The Frame Holding The Archive's Footer Into 'frame', Returning Its Length.
+// The Footer Is Encoded By Hand (As A Stored Block Or An RLE Block) Rather Than By The
+// Library, So It Comes Out Byte For Byte The Same Whatever Library Version Wrote It.
+static size_t footer_frame(compress_type_t type, unsigned char *frame) {
+    if (type == COMPRESS_ZSTD) {
+        // Magic, A Single-Segment Header With A 2-Byte Content Size (1024 - 256), Then One
+        // Last RLE Block Repeating A Zero Byte 1024 Times.
+        static const unsigned char zstd_footer[] = {0x28, 0xb5, 0x2f, 0xfd, 0x60, 0x00,
+                                                    0x03, 0x03, 0x20, 0x00, 0x00};
+        memcpy(frame, zstd_footer, sizeof(zstd_footer));
+        return sizeof(zstd_footer);
+    }
+
+    // A gzip Header With No Name Or Timestamp, Then One Last Stored Block Of 1024 Bytes
+    // (Its Length And The Length's Complement), The Zeros And The CRC And Size Trailer.
+    static const unsigned char gzip_header[] = {0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                                0x00, 0x03, 0x01, 0x00, 0x04, 0xff, 0xfb};
+    size_t len = sizeof(gzip_header);
+    memcpy(frame, gzip_header, len);
+    memset(frame + len, 0, COMPRESS_FOOTER_SIZE);
+    uint32_t trailer[2] = {crc32(0, frame + len, COMPRESS_FOOTER_SIZE), COMPRESS_FOOTER_SIZE};
+    len += COMPRESS_FOOTER_SIZE;
+    for (int i = 0; i < 2; i++) {
+        for (int byte = 0; byte < 4; byte++) {
+            frame[len++] = (trailer[i] >> (8 * byte)) & 0xff;
+        }
+    }
+    return len;
+}
+
+// Writes All 'nbytes' Of 'data' To 'fd', Retrying Short Writes.
+static int write_all(int fd, const char *data, size_t nbytes) {
+    while (nbytes > 0) {
+        ssize_t bytes_written = write(fd, data, nbytes);
+        if (bytes_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to write to tar archive");
+            return -1;
+        }
+        data += bytes_written;
+        nbytes -= bytes_written;
+    }
+    return 0;
+}
+
+// Waits For The Chunk The Producing Side Fills Next.
+// Returns NULL If The Stage Has Failed Or Is Being Shut Down.
+static chunk_t *wait_for_empty(compress_stream_t *cs) {
+    pthread_mutex_lock(&cs->lock);
+    while (!cs->abort && !cs->failed && cs->count == cs->num_chunks) {
+        pthread_cond_wait(&cs->changed, &cs->lock);
+    }
+    chunk_t *chunk = NULL;
+    if (!cs->abort && !cs->failed) {
+        chunk = &cs->chunks[(cs->head + cs->count) % cs->num_chunks];
+    }
+    pthread_mutex_unlock(&cs->lock);
+    return chunk;
+}
+
+// Waits For The Oldest Full Chunk.
+// Returns NULL If The Stage Has Failed Or Is Being Shut Down.
+static chunk_t *wait_for_full(compress_stream_t *cs) {
+    pthread_mutex_lock(&cs->lock);
+    while (!cs->abort && !cs->failed && cs->count == 0) {
+        pthread_cond_wait(&cs->changed, &cs->lock);
+    }
+    chunk_t *chunk = NULL;
+    if (!cs->abort && !cs->failed) {
+        chunk = &cs->chunks[cs->head];
+    }
+    pthread_mutex_unlock(&cs->lock);
+    return chunk;
+}
+
+// Passes The Chunk Just Filled To The Other Side.
+static void hand_over(compress_stream_t *cs) {
+    pthread_mutex_lock(&cs->lock);
+    cs->count++;
+    pthread_cond_broadcast(&cs->changed);
+    pthread_mutex_unlock(&cs->lock);
+}
+
+// Returns The Oldest Full Chunk, Now Emptied, To The Producing Side.
+static void release(compress_stream_t *cs) {
+    pthread_mutex_lock(&cs->lock);
+    chunk_t *chunk = &cs->chunks[cs->head];
+    chunk->len = 0;
+    chunk->pos = 0;
+    chunk->last = 0;
+    cs->head = (cs->head + 1) % cs->num_chunks;
+    cs->head_seq++;
+    cs->count--;
+    pthread_cond_broadcast(&cs->changed);
+    pthread_mutex_unlock(&cs->lock);
+}
+
+static void set_failed(compress_stream_t *cs) {
+    pthread_mutex_lock(&cs->lock);
+    cs->failed = 1;
+    pthread_cond_broadcast(&cs->changed);
+    pthread_mutex_unlock(&cs->lock);
+}
+
+// Waits For A Full Chunk No Other Worker Has Claimed, Setting '*seq' To Its Number.
+// Returns NULL Once The Last Chunk Has Been Claimed, Or If The Stage Has Failed Or Is
+// Being Shut Down.
+static chunk_t *claim_chunk(compress_stream_t *cs, uint64_t *seq) {
+    pthread_mutex_lock(&cs->lock);
+    while (!cs->abort && !cs->failed && !cs->closing &&
+           cs->next_claim == cs->head_seq + cs->count) {
+        pthread_cond_wait(&cs->changed, &cs->lock);
+    }
+    chunk_t *chunk = NULL;
+    if (!cs->abort && !cs->failed && cs->next_claim < cs->head_seq + cs->count) {
+        *seq = cs->next_claim++;
+        chunk = &cs->chunks[(cs->head + (*seq - cs->head_seq)) % cs->num_chunks];
+        if (chunk->last) {
+            cs->closing = 1;
+            pthread_cond_broadcast(&cs->changed);
+        }
+    }
+    pthread_mutex_unlock(&cs->lock);
+    return chunk;
+}
+
+// Waits Until Every Frame Before Chunk 'seq' Has Been Written Out.
+// Returns 0 Once It Is Chunk 'seq''s Turn, Or -1 If The Stage Has Failed Or Is Being Shut
+// Down.
+static int wait_turn(compress_stream_t *cs, uint64_t seq) {
+    pthread_mutex_lock(&cs->lock);
+    while (!cs->abort && !cs->failed && cs->head_seq != seq) {
+        pthread_cond_wait(&cs->changed, &cs->lock);
+    }
+    int status = cs->abort || cs->failed ? -1 : 0;
+    pthread_mutex_unlock(&cs->lock);
+    return status;
+}
+
+// Compresses 'len' Bytes Of 'data' Into A Complete Frame Of Its Own In The Worker's Frame
+// Buffer, Setting '*frame_len' To Its Length.
+static int compress_frame(frame_worker_t *worker, const char *data, size_t len,
+                          size_t *frame_len) {
+    compress_type_t type = worker->cs->type;
+    if (type == COMPRESS_GZIP) {
+        z_stream *z = &worker->codec.zstream;
+        z->next_in = (Bytef *) data;
+        z->avail_in = len;
+        z->next_out = (Bytef *) worker->frame;
+        z->avail_out = worker->frame_capacity;
+        // The Buffer Holds deflateBound's Worst Case, So One Call Finishes The Frame.
+        int ret = deflate(z, Z_FINISH);
+        *frame_len = worker->frame_capacity - z->avail_out;
+        deflateReset(z);
+        if (ret != Z_STREAM_END) {
+            fprintf(stderr, "Failed to compress tar archive: %s\n", zError(ret));
+            return -1;
+        }
+        return 0;
+    }
+#ifdef HAVE_ZSTD
+    if (type == COMPRESS_ZSTD) {
+        size_t ret =
+            ZSTD_compress2(worker->codec.cctx, worker->frame, worker->frame_capacity, data, len);
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "Failed to compress tar archive: %s\n", ZSTD_getErrorName(ret));
+            return -1;
+        }
+        *frame_len = ret;
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+// Writes Out A Compressed Frame Holding 'len' Bytes Of The Archive, Recording Where It
+// Starts, Then The Footer Frame After The Last One.
+static int write_frame(compress_stream_t *cs, const char *frame, size_t frame_len, size_t len,
+                       int last) {
+    if (len > 0) {
+        if (cs->frames != NULL &&
+            frame_table_add(cs->frames, cs->compressed_offset, cs->frame_offset) != 0) {
+            return -1;
+        }
+        if (write_all(cs->fd, frame, frame_len) != 0) {
+            return -1;
+        }
+        cs->compressed_offset += frame_len;
+        cs->frame_offset += len;
+    }
+    if (last) {
+        unsigned char footer[MAX_FOOTER_FRAME];
+        size_t footer_len = footer_frame(cs->type, footer);
+        if (write_all(cs->fd, (const char *) footer, footer_len) != 0) {
+            return -1;
+        }
+        cs->compressed_offset += footer_len;
+    }
+    return 0;
+}
+
+// Compression Worker: Claims Full Chunks And Compresses Each Into A Frame, Then Waits For
+// The Frames Before It To Be Written Before Writing Its Own.
+static void *frame_worker(void *arg) {
+    frame_worker_t *worker = arg;
+    compress_stream_t *cs = worker->cs;
+    chunk_t *chunk;
+    uint64_t seq;
+    while ((chunk = claim_chunk(cs, &seq)) != NULL) {
+        size_t frame_len = 0;
+        int status = 0;
+        if (chunk->len > 0) {
+            status = compress_frame(worker, chunk->data, chunk->len, &frame_len);
+        }
+        if (status == 0) {
+            status = wait_turn(cs, seq);
+        }
+        if (status == 0) {
+            status = write_frame(cs, worker->frame, frame_len, chunk->len, chunk->last);
+        }
+        if (status != 0) {
+            set_failed(cs);
+            break;
+        }
+        release(cs);
+    }
+    return NULL;
+}
+
+// Decompresses What It Can Of The 'len' Bytes At 'data' Into The Free Space Of 'chunk',
+// Setting '*consumed' To The Input Used And '*in_frame' To Whether A Frame Is Still Open.
+static int decompress_data(compress_stream_t *cs, const char *data, size_t len,
+                           size_t *consumed, chunk_t *chunk, int *in_frame) {
+    if (cs->type == COMPRESS_GZIP) {
+        z_stream *z = &cs->codec.zstream;
+        z->next_in = (Bytef *) data;
+        z->avail_in = len;
+        z->next_out = (Bytef *) chunk->data + chunk->len;
+        z->avail_out = CHUNK_SIZE - chunk->len;
+        int ret = inflate(z, Z_NO_FLUSH);
+        *consumed = len - z->avail_in;
+        chunk->len = CHUNK_SIZE - z->avail_out;
+        if (ret == Z_STREAM_END) {
+            // Another gzip Member May Follow, As Appending Adds One.
+            inflateReset(z);
+            *in_frame = 0;
+        } else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+            *in_frame |= *consumed > 0;
+        } else {
+            fprintf(stderr, "Failed to read from tar archive: %s\n",
+                    z->msg != NULL ? z->msg : zError(ret));
+            return -1;
+        }
+        return 0;
+    }
+#ifdef HAVE_ZSTD
+    if (cs->type == COMPRESS_ZSTD) {
+        ZSTD_inBuffer input = {data, len, 0};
+        ZSTD_outBuffer output = {chunk->data, CHUNK_SIZE, chunk->len};
+        size_t ret = ZSTD_decompressStream(cs->codec.dctx, &output, &input);
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "Failed to read from tar archive: %s\n", ZSTD_getErrorName(ret));
+            return -1;
+        }
+        *consumed = input.pos;
+        chunk->len = output.pos;
+        *in_frame = ret != 0;
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+// Reads Up To 'len' More Bytes Of Input Into 'data', From Where The Stage Has Got To In 'fd'.
+// Returns The Number Of Bytes Read (0 At The End) Or -1 On Error, Like read.
+static ssize_t read_input(compress_stream_t *cs, char *data, size_t len) {
+    ssize_t bytes_read = cs->pipe ? read(cs->fd, data, len)
+                                  : pread(cs->fd, data, len, cs->compressed_offset);
+    if (bytes_read > 0) {
+        cs->compressed_offset += bytes_read;
+    }
+    return bytes_read;
+}
+
+// Decompression Worker: Reads The Compressed Archive And Fills Chunks With Its Contents,
+// Marking The Chunk That Holds The End Of The Data As The Last.
+static void *decompress_worker(void *arg) {
+    compress_stream_t *cs = arg;
+    memcpy(cs->io_buf, cs->peeked, cs->peeked_len);
+    size_t in_len = cs->peeked_len;
+    size_t in_pos = 0;
+    int in_frame = 0;
+    int drained = 1;    // The library holds no output it has yet to hand over
+    int eof = 0;
+    int status = 0;
+
+    chunk_t *chunk;
+    while (status == 0 && (chunk = wait_for_empty(cs)) != NULL) {
+        while (status == 0 && !eof && chunk->len < CHUNK_SIZE) {
+            if (in_pos == in_len && drained) {
+                ssize_t bytes_read = read_input(cs, cs->io_buf, CHUNK_SIZE);
+                if (bytes_read < 0) {
+                    if (errno != EINTR) {
+                        perror("Failed to read from tar archive");
+                        status = -1;
+                    }
+                    continue;
+                }
+                if (bytes_read == 0) {
+                    eof = 1;
+                    break;
+                }
+                in_len = bytes_read;
+                in_pos = 0;
+            }
+
+            size_t consumed;
+            size_t len_before = chunk->len;
+            status = decompress_data(cs, cs->io_buf + in_pos, in_len - in_pos, &consumed, chunk,
+                                     &in_frame);
+            in_pos += consumed;
+            // Once Output Stops Coming With No Input Left, More Has To Be Read.
+            drained = in_pos < in_len ? 0 : chunk->len < CHUNK_SIZE || chunk->len == len_before;
+        }
+        if (status == 0 && eof && in_frame) {
+            fprintf(stderr, "Failed to read from tar archive: compressed data is truncated\n");
+            status = -1;
+        }
+        if (status != 0) {
+            break;
+        }
+        chunk->last = eof;
+        hand_over(cs);
+        if (eof) {
+            break;
+        }
+    }
+
+    if (status != 0) {
+        set_failed(cs);
+    }
+    return NULL;
+}
+
+// Copy Worker: Reads An Uncompressed Archive Coming Down A Pipe Straight Into Chunks, So
+// The Caller's Reads Overlap With Waiting On The Pipe.
+static void *copy_worker(void *arg) {
+    compress_stream_t *cs = arg;
+    int eof = 0;
+    int status = 0;
+
+    chunk_t *chunk;
+    while (status == 0 && !eof && (chunk = wait_for_empty(cs)) != NULL) {
+        if (cs->peeked_len > 0) {
+            memcpy(chunk->data, cs->peeked, cs->peeked_len);
+            chunk->len = cs->peeked_len;
+            cs->peeked_len = 0;
+        }
+        while (chunk->len < CHUNK_SIZE) {
+            ssize_t bytes_read = read_input(cs, chunk->data + chunk->len, CHUNK_SIZE - chunk->len);
+            if (bytes_read < 0 && errno == EINTR) {
+                continue;
+            } else if (bytes_read < 0) {
+                perror("Failed to read from tar archive");
+                status = -1;
+                break;
+            } else if (bytes_read == 0) {
+                eof = 1;
+                break;
+            }
+            chunk->len += bytes_read;
+        }
+        if (status == 0) {
+            chunk->last = eof;
+            hand_over(cs);
+        }
+    }
+
+    if (status != 0) {
+        set_failed(cs);
+    }
+    return NULL;
+}
+
+// Sets Up The Library's State For Compressing Or Decompressing Data Of 'type'.
+static int codec_init(codec_t *codec, compress_type_t type, int writing) {
+    if (type == COMPRESS_GZIP) {
+        int ret = writing ? deflateInit2(&codec->zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                                         GZIP_WINDOW_BITS, GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY)
+                          : inflateInit2(&codec->zstream, GZIP_WINDOW_BITS);
+        if (ret != Z_OK) {
+            fprintf(stderr, "Failed to set up gzip stream: %s\n", zError(ret));
+            return -1;
+        }
+        return 0;
+    }
+#ifdef HAVE_ZSTD
+    if (type == COMPRESS_ZSTD) {
+        if (writing) {
+            codec->cctx = ZSTD_createCCtx();
+            // Every Frame Carries A Checksum Of Its Contents, Like A gzip Member Does.
+            if (codec->cctx != NULL) {
+                ZSTD_CCtx_setParameter(codec->cctx, ZSTD_c_checksumFlag, 1);
+            }
+        } else {
+            codec->dctx = ZSTD_createDCtx();
+        }
+        if (codec->cctx == NULL && codec->dctx == NULL) {
+            fprintf(stderr, "Failed to set up zstd stream\n");
+            return -1;
+        }
+        return 0;
+    }
+#endif
+    fprintf(stderr, "Failed to set up compression: minitar was built without support for it\n");
+    return -1;
+}
+
+static void codec_free(codec_t *codec, compress_type_t type, int writing) {
+    if (type == COMPRESS_GZIP) {
+        if (writing) {
+            deflateEnd(&codec->zstream);
+        } else {
+            inflateEnd(&codec->zstream);
+        }
+    }
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(codec->cctx);
+    ZSTD_freeDCtx(codec->dctx);
+#endif
+}
+
+// Returns The Most Bytes A Frame Holding A Whole Chunk Can Take Up Once Compressed.
+static size_t frame_bound(codec_t *codec, compress_type_t type) {
+#ifdef HAVE_ZSTD
+    if (type == COMPRESS_ZSTD) {
+        return ZSTD_compressBound(CHUNK_SIZE);
+    }
+#endif
+    return deflateBound(&codec->zstream, CHUNK_SIZE);
+}
+
+// Joins Every Thread Of The Stage That Was Started, Then Frees The Stage.
+// The Library Calls Used Here All Accept State That Was Never Set Up.
+static void stream_free(compress_stream_t *cs) {
+    for (int i = 0; i < cs->num_workers; i++) {
+        if (cs->workers[i].started) {
+            pthread_join(cs->workers[i].thread, NULL);
+        }
+        codec_free(&cs->workers[i].codec, cs->type, 1);
+        free(cs->workers[i].frame);
+    }
+    free(cs->workers);
+    if (!cs->writing) {
+        codec_free(&cs->codec, cs->type, 0);
+    }
+    for (size_t i = 0; i < cs->num_chunks; i++) {
+        free(cs->chunks[i].data);
+    }
+    free(cs->chunks);
+    free(cs->io_buf);
+    pthread_cond_destroy(&cs->changed);
+    pthread_mutex_destroy(&cs->lock);
+    free(cs);
+}
+
+// Stops The Workers Without Waiting For Them To Finish Their Data, Then Frees The Stage.
+static void stream_abort(compress_stream_t *cs) {
+    pthread_mutex_lock(&cs->lock);
+    cs->abort = 1;
+    pthread_cond_broadcast(&cs->changed);
+    pthread_mutex_unlock(&cs->lock);
+    if (!cs->writing) {
+        pthread_join(cs->thread, NULL);
+    }
+    stream_free(cs);
+}
+
+// Sets Up The Compression Threads Of A Writing Stage, Each With Its Own Library State And
+// Room For The Largest Frame It Can Produce, And Starts Them.
+static int start_frame_workers(compress_stream_t *cs) {
+    cs->workers = calloc(cs->num_workers, sizeof(frame_worker_t));
+    if (cs->workers == NULL) {
+        perror("Failed to allocate compression stage");
+        cs->num_workers = 0;
+        return -1;
+    }
+    for (int i = 0; i < cs->num_workers; i++) {
+        frame_worker_t *worker = &cs->workers[i];
+        worker->cs = cs;
+        if (codec_init(&worker->codec, cs->type, 1) != 0) {
+            return -1;
+        }
+        worker->frame_capacity = frame_bound(&worker->codec, cs->type);
+        worker->frame = malloc(worker->frame_capacity);
+        if (worker->frame == NULL) {
+            perror("Failed to allocate compression stage");
+            return -1;
+        }
+    }
+    for (int i = 0; i < cs->num_workers; i++) {
+        int err = pthread_create(&cs->workers[i].thread, NULL, frame_worker, &cs->workers[i]);
+        if (err != 0) {
+            errno = err;
+            perror("Failed to start compression thread");
+            return -1;
+        }
+        cs->workers[i].started = 1;
+    }
+    return 0;
+}
+
+// Sets Up A Stage Over 'fd' And Starts Its Threads.
+// A Reading Stage Given 'head' Reads 'fd' In Order, Like A Pipe, Taking The 'head_len'
+// Bytes At 'head' As The Ones Already Read Off It.
+static compress_stream_t *stream_start(int fd, compress_type_t type, int writing,
+                                       int num_threads, off_t offset, off_t compressed_offset,
+                                       const unsigned char *head, size_t head_len) {
+    compress_stream_t *cs = calloc(1, sizeof(compress_stream_t));
+    if (cs == NULL) {
+        perror("Failed to allocate compression stage");
+        return NULL;
+    }
+    cs->fd = fd;
+    cs->type = type;
+    cs->writing = writing;
+    cs->position = offset;
+    cs->frame_offset = offset;
+    cs->compressed_offset = compressed_offset;
+    cs->pipe = head != NULL;
+    if (head_len > 0) {
+        memcpy(cs->peeked, head, head_len);
+        cs->peeked_len = head_len;
+    }
+    pthread_mutex_init(&cs->lock, NULL);
+    pthread_cond_init(&cs->changed, NULL);
+
+    cs->num_chunks = num_threads * CHUNKS_PER_THREAD;
+    if (cs->num_chunks < MIN_CHUNKS) {
+        cs->num_chunks = MIN_CHUNKS;
+    }
+    cs->chunks = calloc(cs->num_chunks, sizeof(chunk_t));
+    int status = cs->chunks != NULL ? 0 : -1;
+    for (size_t i = 0; i < cs->num_chunks && status == 0; i++) {
+        cs->chunks[i].data = malloc(CHUNK_SIZE);
+        status = cs->chunks[i].data != NULL ? 0 : -1;
+    }
+    if (status == 0 && !writing) {
+        cs->io_buf = malloc(CHUNK_SIZE);
+        status = cs->io_buf != NULL ? 0 : -1;
+    }
+    if (status != 0) {
+        perror("Failed to allocate compression stage");
+        if (cs->chunks == NULL) {
+            cs->num_chunks = 0;
+        }
+        stream_free(cs);
+        return NULL;
+    }
+
+    if (writing) {
+        cs->num_workers = num_threads;
+        if (start_frame_workers(cs) != 0) {
+            stream_abort(cs);
+            return NULL;
+        }
+        return cs;
+    }
+
+    if (type != COMPRESS_NONE && codec_init(&cs->codec, type, 0) != 0) {
+        stream_free(cs);
+        return NULL;
+    }
+    void *(*worker)(void *) = type != COMPRESS_NONE ? decompress_worker : copy_worker;
+    int err = pthread_create(&cs->thread, NULL, worker, cs);
+    if (err != 0) {
+        errno = err;
+        perror("Failed to start compression thread");
+        stream_free(cs);
+        return NULL;
+    }
+    return cs;
+}
+
+static ssize_t stream_write(void *cookie, const char *data, size_t size) {
+    compress_stream_t *cs = cookie;
+    size_t written = 0;
+    while (written < size) {
+        chunk_t *chunk = wait_for_empty(cs);
+        if (chunk == NULL) {
+            errno = EIO;
+            return -1;
+        }
+        size_t bytes_to_copy = size - written;
+        if (bytes_to_copy > CHUNK_SIZE - chunk->len) {
+            bytes_to_copy = CHUNK_SIZE - chunk->len;
+        }
+        memcpy(chunk->data + chunk->len, data + written, bytes_to_copy);
+        chunk->len += bytes_to_copy;
+        written += bytes_to_copy;
+        if (chunk->len == CHUNK_SIZE) {
+            hand_over(cs);
+        }
+    }
+    cs->position += size;
+    return size;
+}
+
+static ssize_t stream_read(void *cookie, char *data, size_t size) {
+    compress_stream_t *cs = cookie;
+    size_t copied = 0;
+    while (copied < size) {
+        chunk_t *chunk = wait_for_full(cs);
+        if (chunk == NULL) {
+            errno = EIO;
+            return -1;
+        }
+        size_t bytes_to_copy = size - copied;
+        if (bytes_to_copy > chunk->len - chunk->pos) {
+            bytes_to_copy = chunk->len - chunk->pos;
+        }
+        memcpy(data + copied, chunk->data + chunk->pos, bytes_to_copy);
+        chunk->pos += bytes_to_copy;
+        copied += bytes_to_copy;
+
+        // The Last Chunk Is Kept, So Every Read After The End Finds It Empty.
+        if (chunk->pos == chunk->len) {
+            if (chunk->last) {
+                break;
+            }
+            release(cs);
+        }
+    }
+    cs->position += copied;
+    return copied;
+}
+
+// Only Asking For The Current Position (As ftello Does) Is Supported.
+static int stream_seek(void *cookie, off64_t *offset, int whence) {
+    compress_stream_t *cs = cookie;
+    if ((whence == SEEK_CUR && *offset == 0) || (whence == SEEK_SET && *offset == cs->position)) {
+        *offset = cs->position;
+        return 0;
+    }
+    errno = ESPIPE;
+    return -1;
+}
+
+static int stream_close(void *cookie) {
+    compress_stream_t *cs = cookie;
+    int fd = cs->fd;
+    int status = 0;
+    if (!cs->writing) {
+        stream_abort(cs);
+        return 0;
+    }
+
+    // The Partly Filled Chunk Goes Last, Becoming The Last Frame.
+    chunk_t *chunk = wait_for_empty(cs);
+    if (chunk != NULL) {
+        chunk->last = 1;
+        hand_over(cs);
+    }
+    for (int i = 0; i < cs->num_workers; i++) {
+        pthread_join(cs->workers[i].thread, NULL);
+        cs->workers[i].started = 0;
+    }
+    status = cs->failed ? -1 : 0;
+    stream_free(cs);
+
+    if (close(fd) != 0) {
+        status = -1;
+    }
+    if (status != 0 && errno == 0) {
+        errno = EIO;
+    }
+    return status;
+}
+
+// Wraps A Stage In A stdio Stream, So The Archive Code Can Use It Like Any Other FILE.
+static FILE *stream_open(compress_stream_t *cs, const char *mode) {
+    cookie_io_functions_t io = {
+        .read = cs->writing ? NULL : stream_read,
+        .write = cs->writing ? stream_write : NULL,
+        .seek = stream_seek,
+        .close = stream_close,
+    };
+    FILE *stream = fopencookie(cs, mode, io);
+    if (stream == NULL) {
+        perror("Failed to open compression stage");
+        stream_abort(cs);
+    }
+    return stream;
+}
+
+FILE *compress_open_write(int fd, compress_type_t type, int num_threads, off_t offset,
+                          compress_frame_table_t *frames) {
+    // A Pipe Has No Offset, So Frames Written Into One Are Placed From Where It Starts.
+    off_t compressed_offset = lseek(fd, 0, SEEK_CUR);
+    if (compressed_offset == -1 && errno == ESPIPE) {
+        compressed_offset = 0;
+    } else if (compressed_offset == -1) {
+        perror("Failed to seek in tar archive");
+        return NULL;
+    }
+    compress_stream_t *cs =
+        stream_start(fd, type, 1, num_threads, offset, compressed_offset, NULL, 0);
+    if (cs == NULL) {
+        return NULL;
+    }
+    cs->frames = frames;
+    return stream_open(cs, "w");
+}
+
+FILE *compress_open_read(int fd, compress_type_t type, off_t compressed_offset) {
+    compress_stream_t *cs = stream_start(fd, type, 0, 1, 0, compressed_offset, NULL, 0);
+    if (cs == NULL) {
+        return NULL;
+    }
+    return stream_open(cs, "r");
+}
+
+FILE *compress_open_pipe(int fd, compress_type_t *type) {
+    // Nothing Can Be Peeked At On A Pipe, So The Magic Bytes Are Read Off It, Then Handed
+    // To The Stage As The Start Of Its Input.
+    unsigned char head[sizeof(zstd_magic)];
+    size_t head_len = 0;
+    while (head_len < sizeof(head)) {
+        ssize_t bytes_read = read(fd, head + head_len, sizeof(head) - head_len);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        } else if (bytes_read < 0) {
+            perror("Failed to read from tar archive");
+            return NULL;
+        } else if (bytes_read == 0) {
+            break;
+        }
+        head_len += bytes_read;
+    }
+
+    *type = detect_magic(head, head_len);
+    compress_stream_t *cs = stream_start(fd, *type, 0, 1, 0, 0, head, head_len);
+    if (cs == NULL) {
+        return NULL;
+    }
+    return stream_open(cs, "r");
+}
+
+int compress_remove_footer(int fd, compress_type_t type) {
+    unsigned char expected[MAX_FOOTER_FRAME];
+    unsigned char actual[MAX_FOOTER_FRAME];
+    size_t frame_len = footer_frame(type, expected);
+
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) != 0) {
+        perror("Failed to stat tar archive");
+        return -1;
+    }
+    if (stat_buf.st_size < frame_len) {
+        return 1;
+    }
+    off_t frame_offset = stat_buf.st_size - frame_len;
+    ssize_t bytes_read = pread(fd, actual, frame_len, frame_offset);
+    if (bytes_read < 0) {
+        perror("Failed to read from tar archive");
+        return -1;
+    }
+    if (bytes_read != frame_len || memcmp(actual, expected, frame_len) != 0) {
+        return 1;
+    }
+
+    if (ftruncate(fd, frame_offset) != 0) {
+        perror("Failed to remove footer from tar archive");
+        return -1;
+    }
+    return 0;
+}
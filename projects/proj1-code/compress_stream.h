@@ -0,0 +1,79 @@
+#ifndef _COMPRESS_STREAM_H
+#define _COMPRESS_STREAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// Compression applied to a whole archive
+typedef enum {
+    COMPRESS_NONE,
+    COMPRESS_GZIP,    // Concatenated gzip members (zlib)
+    COMPRESS_ZSTD,    // Concatenated zstd frames, if minitar was built with libzstd
+} compress_type_t;
+
+// Bytes of zeros that end a tar archive. A compressed archive keeps them in a frame of their
+// own at the very end, so appending can cut them off without touching anything before.
+#define COMPRESS_FOOTER_SIZE 1024
+
+// Where one frame of a compressed archive starts, both in the compressed file and in the
+// archive it holds. Each frame decompresses on its own, so reading can begin at any of them.
+typedef struct {
+    uint64_t compressed_offset;
+    uint64_t offset;
+} compress_frame_t;
+
+// Frames in the order they were written
+typedef struct {
+    compress_frame_t *frames;
+    size_t count;
+    size_t capacity;
+} compress_frame_table_t;
+
+// Initialize a new, empty frame table
+void compress_frame_table_init(compress_frame_table_t *table);
+
+// Free any memory associated with the table and leave it empty
+void compress_frame_table_clear(compress_frame_table_t *table);
+
+// Returns 1 if minitar was built with support for 'type', 0 if not
+int compress_available(compress_type_t type);
+
+// Work out how the file open as 'fd' is compressed from its first bytes, without moving its
+// file offset
+// Returns 0 with '*type' set (COMPRESS_NONE for anything unrecognized) or -1 on error
+int compress_detect(int fd, compress_type_t *type);
+
+// Open a stream that compresses everything written to it into 'fd', at its current offset
+// (or into a pipe).
+// The data is cut into fixed-size frames that are compressed independently, by up to
+// 'num_threads' threads at once, and written out in order.
+// Closing the stream ends the last frame, adds the footer frame and closes 'fd', so
+// nothing but the archive's members should be written to it.
+// ftello on the stream gives the uncompressed position, starting from 'offset'.
+// Where each frame starts is added to 'frames' as it is written, unless it is NULL; the
+// table is complete once the stream is closed.
+// Returns the stream, or NULL if an error occurs (leaving 'fd' open)
+FILE *compress_open_write(int fd, compress_type_t type, int num_threads, off_t offset,
+                          compress_frame_table_t *frames);
+
+// Open a stream that reads the decompressed contents of 'fd' from the frame starting at
+// 'compressed_offset', decompressing on a thread of its own. The stream can only be read
+// front to back. 'fd' is read with pread, so it can be shared, and is left open.
+// Returns the stream, or NULL if an error occurs
+FILE *compress_open_read(int fd, compress_type_t type, off_t compressed_offset);
+
+// Open a stream that reads the archive coming in on 'fd', a pipe or anything else that can
+// only be read in order, decompressing it on a thread of its own if its first bytes say it
+// is compressed (and reading ahead on that thread if it is not). '*type' is set to its
+// compression. 'fd' is left open.
+// Returns the stream, or NULL if an error occurs
+FILE *compress_open_pipe(int fd, compress_type_t *type);
+
+// Truncate the footer frame off the end of the compressed archive open as 'fd', so more
+// data can be appended after it
+// Returns 0 on success, 1 if the archive does not end in a footer frame written by
+// compress_open_write, or -1 if an error occurs
+int compress_remove_footer(int fd, compress_type_t type);
+
+#endif    // _COMPRESS_STREAM_H
@@ -5,50 +5,146 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define INITIAL_BUCKETS 16
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+#define ARENA_ALIGN sizeof(void *)
+#define MIN_CHUNK_SIZE 4096
+#define MAX_CHUNK_SIZE (1 << 20)
+
+// FNV-1a hash over a whole name
+static unsigned hash_name(const char *name) {
+    unsigned hash = FNV_OFFSET_BASIS;
+    for (int i = 0; name[i] != '\0'; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// Find the bucket holding 'file_name', or the empty bucket where it would go
+static node_t **find_bucket(node_t **buckets, int num_buckets, const char *file_name,
+                            unsigned hash) {
+    unsigned mask = num_buckets - 1;
+    unsigned i = hash & mask;
+    while (buckets[i] != NULL) {
+        if (buckets[i]->hash == hash && strcmp(buckets[i]->name, file_name) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return &buckets[i];
+}
+
+// Double the number of buckets, re-inserting every indexed node
+static int grow_index(file_list_t *list) {
+    int num_buckets = list->num_buckets == 0 ? INITIAL_BUCKETS : list->num_buckets * 2;
+    node_t **buckets = calloc(num_buckets, sizeof(node_t *));
+    if (buckets == NULL) {
+        return 1;
+    }
+    for (int i = 0; i < list->num_buckets; i++) {
+        node_t *node = list->buckets[i];
+        if (node != NULL) {
+            *find_bucket(buckets, num_buckets, node->name, node->hash) = node;
+        }
+    }
+    free(list->buckets);
+    list->buckets = buckets;
+    list->num_buckets = num_buckets;
+    return 0;
+}
+
+// Add a chunk of at least 'capacity' bytes to the front of the list's arena
+static chunk_t *add_chunk(file_list_t *list, size_t capacity) {
+    chunk_t *chunk = malloc(sizeof(chunk_t) + capacity);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->next = list->chunks;
+    chunk->used = 0;
+    chunk->capacity = capacity;
+    list->chunks = chunk;
+    return chunk;
+}
+
+// Carve 'nbytes' out of the list's arena, starting a new (larger) chunk if needed
+static void *arena_alloc(file_list_t *list, size_t nbytes) {
+    nbytes = (nbytes + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    chunk_t *chunk = list->chunks;
+    if (chunk == NULL || chunk->capacity - chunk->used < nbytes) {
+        size_t capacity = MIN_CHUNK_SIZE;
+        if (chunk != NULL && chunk->capacity < MAX_CHUNK_SIZE) {
+            capacity = chunk->capacity * 2;
+        } else if (chunk != NULL) {
+            capacity = MAX_CHUNK_SIZE;
+        }
+        if (capacity < nbytes) {
+            capacity = nbytes;
+        }
+        chunk = add_chunk(list, capacity);
+        if (chunk == NULL) {
+            return NULL;
+        }
+    }
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += nbytes;
+    return ptr;
+}
+
 void file_list_init(file_list_t *list) {
     list->head = NULL;
+    list->tail = NULL;
     list->size = 0;
+    list->buckets = NULL;
+    list->num_buckets = 0;
+    list->num_indexed = 0;
+    list->chunks = NULL;
 }
 
 int file_list_add(file_list_t *list, const char *file_name) {
-    if (list->head == NULL) {
-        list->head = malloc(sizeof(node_t));
-        if (list->head == NULL) {
-            return 1;
-        }
-        strncpy(list->head->name, file_name, MAX_NAME_LEN);
-        list->head->next = NULL;
-        list->size = 1;
-        return 0;
+    // Keep the index at most 3/4 full so probe sequences stay short
+    if ((list->num_indexed + 1) * 4 > list->num_buckets * 3 && grow_index(list) != 0) {
+        return 1;
     }
 
-    node_t *current = list->head;
-    while (current->next != NULL) {
-        current = current->next;
-    }
-    current->next = malloc(sizeof(node_t));
-    if (current->next == NULL) {
+    // The node and its name are allocated back to back from the arena
+    size_t name_len = strlen(file_name);
+    node_t *node = arena_alloc(list, sizeof(node_t) + name_len + 1);
+    if (node == NULL) {
         return 1;
     }
-    strncpy(current->next->name, file_name, MAX_NAME_LEN);
-    current->next->next = NULL;
+    node->name = (char *) (node + 1);
+    memcpy(node->name, file_name, name_len + 1);
+    node->hash = hash_name(file_name);
+    node->next = NULL;
+
+    // Only the first occurrence of a name goes into the index
+    node_t **bucket = find_bucket(list->buckets, list->num_buckets, node->name, node->hash);
+    if (*bucket == NULL) {
+        *bucket = node;
+        list->num_indexed++;
+    }
+
+    if (list->tail == NULL) {
+        list->head = node;
+    } else {
+        list->tail->next = node;
+    }
+    list->tail = node;
     list->size++;
     return 0;
 }
 
 int file_list_contains(const file_list_t *list, const char *file_name) {
-    node_t *current = list->head;
-    while (current != NULL) {
-        if (strcmp(current->name, file_name) == 0) {
-            return 1;
-        }
-        current = current->next;
+    if (list->num_buckets == 0) {
+        return 0;
     }
-    return 0;
+    unsigned hash = hash_name(file_name);
+    return *find_bucket(list->buckets, list->num_buckets, file_name, hash) != NULL;
 }
 
 int file_list_is_subset(const file_list_t *l1, const file_list_t *l2) {
-    // This approach is not particularly efficient
     node_t *current = l1->head;
     while (current != NULL) {
         if (!file_list_contains(l2, current->name)) {
@@ -59,13 +155,33 @@ int file_list_is_subset(const file_list_t *l1, const file_list_t *l2) {
     return 1;
 }
 
+int file_list_reserve(file_list_t *list, int count, size_t names_size) {
+    // Grow the index until 'count' more distinct names fit without a rehash
+    while ((list->num_indexed + count) * 4 > list->num_buckets * 3) {
+        if (grow_index(list) != 0) {
+            return 1;
+        }
+    }
+
+    // Each node's name is rounded up to the arena alignment, so allow for that too
+    size_t nbytes = (size_t) count * (sizeof(node_t) + ARENA_ALIGN) + names_size;
+    chunk_t *chunk = list->chunks;
+    if (chunk == NULL || chunk->capacity - chunk->used < nbytes) {
+        if (add_chunk(list, nbytes) == NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 void file_list_clear(file_list_t *list) {
-    node_t *current = list->head;
+    // Nodes live in the arena, so releasing its chunks frees every node at once
+    chunk_t *current = list->chunks;
     while (current != NULL) {
-        node_t *to_free = current;
+        chunk_t *to_free = current;
         current = current->next;
         free(to_free);
     }
-    list->head = NULL;
-    list->size = 0;
+    free(list->buckets);
+    file_list_init(list);
 }
@@ -3,18 +3,35 @@
 #ifndef _FILE_LIST_H
 #define _FILE_LIST_H
 
-#define MAX_NAME_LEN 32
+#include <stddef.h>
 
 //  Definition of each node in the linked list
 typedef struct node {
-    char name[MAX_NAME_LEN];
+    char *name;    // Null-terminated, any length
+    unsigned hash;
     struct node *next;
 } node_t;
 
+// Block of memory that a list carves its nodes and names out of
+// Chunks are only ever released all together, by file_list_clear
+typedef struct chunk {
+    struct chunk *next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} chunk_t;
+
 // Linked list definition
+// Alongside the list itself is an open-addressing hash index over the names,
+// so membership tests do not need to walk the list
 typedef struct {
     node_t *head;
+    node_t *tail;
     int size;
+    node_t **buckets;    // First node holding each distinct name, NULL if empty
+    int num_buckets;     // Always a power of two
+    int num_indexed;     // Number of distinct names in the index
+    chunk_t *chunks;     // Arena holding every node and name, newest chunk first
 } file_list_t;
 
 // Initialize a new, empty list
@@ -24,15 +41,22 @@ void file_list_init(file_list_t *list);
 // Returns 0 on success or 1 if an error occurs
 int file_list_add(file_list_t *list, const char *file_name);
 
+// Make room for at least 'count' more entries, whose names take 'names_size' bytes in
+// total (counting their null terminators), up front, e.g. when the members of an archive
+// are already known
+// Returns 0 on success or 1 if an error occurs
+int file_list_reserve(file_list_t *list, int count, size_t names_size);
+
 // Remove all entries from the list and free any memory associated with them
 void file_list_clear(file_list_t *list);
 
-// Determine if a file name is contained in a list
+// Determine if a file name is contained in a list, in constant time
 // Returns 1 if the name is present as an element in the list, 0 otherwise
 int file_list_contains(const file_list_t *list, const char *file_name);
 
 // Determine if the elements of l1 are a subset of the elements of l2
 // That is, all elements of l1 are contained in l2
+// Runs in time linear in the size of l1
 // Returns 1 if l1 is a subset of l2, 0 otherwise
 int file_list_is_subset(const file_list_t *l1, const file_list_t *l2);
 
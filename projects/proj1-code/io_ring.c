@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+#include "io_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#define BUFFER_ALIGNMENT 4096
+// Opcodes the kernel reports on when probed
+#define MAX_PROBE_OPS 256
+
+#ifdef HAVE_IO_URING
+
+struct io_ring {
+    int ring_fd;
+    // Submission queue, shared with the kernel
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    // Completion queue, shared with the kernel
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    // Mappings behind the queues; the completion queue shares the submission queue's
+    // mapping when the kernel supports it
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned num_queued;     // Operations queued but not yet handed to the kernel
+    unsigned num_pending;    // Operations whose results have not been taken
+    char *buffers;           // The registered buffers, back to back
+    size_t buffer_size;
+};
+
+// Every operation the ring is used for, all there since Linux 5.6
+static const int required_ops[] = {
+    IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ_FIXED,
+    IORING_OP_WRITE_FIXED, IORING_OP_CLOSE,
+};
+
+// Maps The Submission And Completion Queues The Kernel Set Up Into Our Address Space.
+static int map_rings(io_ring_t *ring, const struct io_uring_params *params) {
+    ring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    if (params->features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        return -1;
+    }
+    if (params->features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            return -1;
+        }
+    }
+    ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        return -1;
+    }
+
+    char *sq = ring->sq_ring;
+    ring->sq_head = (unsigned *) (sq + params->sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params->sq_off.tail);
+    ring->sq_array = (unsigned *) (sq + params->sq_off.array);
+    ring->sq_mask = *(unsigned *) (sq + params->sq_off.ring_mask);
+    ring->sq_entries = params->sq_entries;
+    char *cq = ring->cq_ring;
+    ring->cq_head = (unsigned *) (cq + params->cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params->cq_off.tail);
+    ring->cq_mask = *(unsigned *) (cq + params->cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params->cq_off.cqes);
+    return 0;
+}
+
+// Asks The Kernel Whether It Supports Every Operation In required_ops.
+// Kernels Too Old To Answer Are Too Old To Have Them All.
+static int ops_supported(io_ring_t *ring) {
+    size_t probe_size =
+        sizeof(struct io_uring_probe) + MAX_PROBE_OPS * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    if (probe == NULL) {
+        return 0;
+    }
+    int supported = syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_PROBE, probe,
+                            MAX_PROBE_OPS) == 0;
+    for (size_t i = 0; supported && i < sizeof(required_ops) / sizeof(required_ops[0]); i++) {
+        int op = required_ops[i];
+        supported = op < probe->ops_len && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+// Registers Each Buffer With The Kernel, Which Pins Its Pages For The Life Of The Ring.
+static int register_buffers(io_ring_t *ring, unsigned num_buffers) {
+    struct iovec *iovecs = calloc(num_buffers, sizeof(struct iovec));
+    if (iovecs == NULL) {
+        return -1;
+    }
+    for (unsigned i = 0; i < num_buffers; i++) {
+        iovecs[i].iov_base = ring->buffers + i * ring->buffer_size;
+        iovecs[i].iov_len = ring->buffer_size;
+    }
+    int status = syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_BUFFERS, iovecs,
+                         num_buffers);
+    free(iovecs);
+    return status == 0 ? 0 : -1;
+}
+
+// Releases The Ring Without Waiting For Anything In Flight.
+static void release_ring(io_ring_t *ring) {
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->ring_fd != -1) {
+        close(ring->ring_fd);
+    }
+    free(ring->buffers);
+    free(ring);
+}
+
+int io_ring_open(io_ring_t **ring_out, unsigned depth, unsigned num_buffers, size_t buffer_size) {
+    io_ring_t *ring = calloc(1, sizeof(io_ring_t));
+    if (ring == NULL) {
+        perror("Failed to allocate io_uring");
+        return -1;
+    }
+    ring->ring_fd = -1;
+    ring->buffer_size = buffer_size;
+    void *buffers;
+    int err = posix_memalign(&buffers, BUFFER_ALIGNMENT, num_buffers * buffer_size);
+    if (err != 0) {
+        errno = err;
+        perror("Failed to allocate io_uring buffers");
+        free(ring);
+        return -1;
+    }
+    ring->buffers = buffers;
+
+    // Anything Going Wrong From Here On Means io_uring Is Missing, Disabled Or Too Limited
+    // To Use (e.g. Not Allowed To Pin The Buffers), Which Ordinary System Calls Cope With.
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(struct io_uring_params));
+    ring->ring_fd = syscall(__NR_io_uring_setup, depth, &params);
+    if (ring->ring_fd == -1 || map_rings(ring, &params) != 0 || !ops_supported(ring) ||
+        register_buffers(ring, num_buffers) != 0) {
+        release_ring(ring);
+        return 1;
+    }
+    *ring_out = ring;
+    return 0;
+}
+
+char *io_ring_buffer(io_ring_t *ring, unsigned index) {
+    return ring->buffers + index * ring->buffer_size;
+}
+
+// Hands Queued Operations To The Kernel, Waiting For 'min_complete' Of Them To Finish.
+static int enter_ring(io_ring_t *ring, unsigned min_complete) {
+    while (1) {
+        unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+        int submitted = syscall(__NR_io_uring_enter, ring->ring_fd, ring->num_queued,
+                                min_complete, flags, NULL, 0);
+        if (submitted >= 0) {
+            ring->num_queued -= submitted;
+            return 0;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+// Returns A Cleared Entry At The Tail Of The Submission Queue, Making Room If It Is Full.
+static struct io_uring_sqe *next_sqe(io_ring_t *ring, uint8_t opcode, int fd, uint64_t tag) {
+    unsigned tail = *ring->sq_tail;
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries) {
+        if (enter_ring(ring, 0) != 0) {
+            return NULL;
+        }
+        if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries) {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+    unsigned index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = tag;
+    ring->sq_array[index] = index;
+    return sqe;
+}
+
+// Publishes The Entry Filled In Since next_sqe To The Kernel.
+static int push_sqe(io_ring_t *ring) {
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+    ring->num_queued++;
+    ring->num_pending++;
+    return 0;
+}
+
+int io_ring_queue_openat(io_ring_t *ring, int dir_fd, const char *path, int flags, mode_t mode,
+                         uint64_t tag) {
+    struct io_uring_sqe *sqe = next_sqe(ring, IORING_OP_OPENAT, dir_fd, tag);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->addr = (uintptr_t) path;
+    sqe->len = mode;
+    sqe->open_flags = flags;
+    return push_sqe(ring);
+}
+
+int io_ring_queue_statx(io_ring_t *ring, int fd, struct statx *statx_buf, uint64_t tag) {
+    struct io_uring_sqe *sqe = next_sqe(ring, IORING_OP_STATX, fd, tag);
+    if (sqe == NULL) {
+        return -1;
+    }
+    // An Empty Path With AT_EMPTY_PATH Stands For 'fd' Itself.
+    sqe->addr = (uintptr_t) "";
+    sqe->len = STATX_BASIC_STATS;
+    sqe->off = (uintptr_t) statx_buf;
+    sqe->statx_flags = AT_EMPTY_PATH;
+    return push_sqe(ring);
+}
+
+int io_ring_queue_read(io_ring_t *ring, int fd, unsigned index, size_t buffer_offset,
+                       size_t len, off_t offset, uint64_t tag) {
+    struct io_uring_sqe *sqe = next_sqe(ring, IORING_OP_READ_FIXED, fd, tag);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->addr = (uintptr_t) (io_ring_buffer(ring, index) + buffer_offset);
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = index;
+    return push_sqe(ring);
+}
+
+int io_ring_queue_write(io_ring_t *ring, int fd, unsigned index, size_t buffer_offset,
+                        size_t len, off_t offset, uint64_t tag) {
+    struct io_uring_sqe *sqe = next_sqe(ring, IORING_OP_WRITE_FIXED, fd, tag);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->addr = (uintptr_t) (io_ring_buffer(ring, index) + buffer_offset);
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = index;
+    return push_sqe(ring);
+}
+
+int io_ring_queue_close(io_ring_t *ring, int fd, uint64_t tag) {
+    if (next_sqe(ring, IORING_OP_CLOSE, fd, tag) == NULL) {
+        return -1;
+    }
+    return push_sqe(ring);
+}
+
+int io_ring_wait(io_ring_t *ring) {
+    int ready = *ring->cq_head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    unsigned min_complete = !ready && ring->num_pending > 0 ? 1 : 0;
+    if (ring->num_queued == 0 && min_complete == 0) {
+        return 0;
+    }
+    return enter_ring(ring, min_complete);
+}
+
+int io_ring_next(io_ring_t *ring, io_ring_result_t *result) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    result->tag = cqe->user_data;
+    result->res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->num_pending--;
+    return 1;
+}
+
+unsigned io_ring_pending(const io_ring_t *ring) {
+    return ring->num_pending;
+}
+
+void io_ring_free(io_ring_t *ring) {
+    // The Kernel May Still Be Reading From Or Writing To Our Memory Until Each Result Is In.
+    io_ring_result_t result;
+    while (ring->num_pending > 0 && io_ring_wait(ring) == 0) {
+        while (io_ring_next(ring, &result) == 1) {
+        }
+    }
+    release_ring(ring);
+}
+
+#else    // HAVE_IO_URING
+
+// Built without the io_uring headers, so every ring is unavailable and callers always
+// fall back to ordinary system calls
+
+struct io_ring {
+    unsigned num_pending;
+};
+
+int io_ring_open(io_ring_t **ring_out, unsigned depth, unsigned num_buffers, size_t buffer_size) {
+    return 1;
+}
+
+char *io_ring_buffer(io_ring_t *ring, unsigned index) {
+    return NULL;
+}
+
+int io_ring_queue_openat(io_ring_t *ring, int dir_fd, const char *path, int flags, mode_t mode,
+                         uint64_t tag) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int io_ring_queue_statx(io_ring_t *ring, int fd, struct statx *statx_buf, uint64_t tag) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int io_ring_queue_read(io_ring_t *ring, int fd, unsigned index, size_t buffer_offset,
+                       size_t len, off_t offset, uint64_t tag) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int io_ring_queue_write(io_ring_t *ring, int fd, unsigned index, size_t buffer_offset,
+                        size_t len, off_t offset, uint64_t tag) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int io_ring_queue_close(io_ring_t *ring, int fd, uint64_t tag) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int io_ring_wait(io_ring_t *ring) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int io_ring_next(io_ring_t *ring, io_ring_result_t *result) {
+    return 0;
+}
+
+unsigned io_ring_pending(const io_ring_t *ring) {
+    return ring->num_pending;
+}
+
+void io_ring_free(io_ring_t *ring) {
+    free(ring);
+}
+
+#endif    // HAVE_IO_URING
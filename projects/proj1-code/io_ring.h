@@ -0,0 +1,73 @@
+#ifndef _IO_RING_H
+#define _IO_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct statx;
+
+// An io_uring instance, driven through the raw system calls, along with a set of buffers
+// registered with the kernel so reads and writes through them skip mapping the pages in
+// every time.
+// Operations are queued with the io_ring_queue_* functions, each tagged with a value of the
+// caller's choosing, and handed to the kernel in batches by io_ring_wait, so many of them
+// are in flight at once; their results come back in whatever order they finish.
+typedef struct io_ring io_ring_t;
+
+// The outcome of one operation
+typedef struct {
+    uint64_t tag;    // As given when the operation was queued
+    int res;         // What the system call would have returned, or -errno on failure
+} io_ring_result_t;
+
+// Sets up a ring for up to 'depth' operations in flight at once, with 'num_buffers'
+// registered buffers of 'buffer_size' bytes each.
+// Returns 0 with '*ring' set, 1 if io_uring (or one of the operations used here) is not
+// available, so the caller should fall back to ordinary system calls, or -1 on error
+int io_ring_open(io_ring_t **ring, unsigned depth, unsigned num_buffers, size_t buffer_size);
+
+// Returns the start of registered buffer 'index'
+char *io_ring_buffer(io_ring_t *ring, unsigned index);
+
+// Each of these queues one operation, which the kernel only sees at the next io_ring_wait.
+// Strings and result buffers passed in must stay alive until the operation's result has
+// been taken with io_ring_next.
+// They return 0 on success or -1 if the queue is full and could not be flushed.
+
+// Open 'path', relative to 'dir_fd', as openat would
+int io_ring_queue_openat(io_ring_t *ring, int dir_fd, const char *path, int flags, mode_t mode,
+                         uint64_t tag);
+
+// Take the metadata of the file open as 'fd', as fstat would, into 'statx_buf'
+int io_ring_queue_statx(io_ring_t *ring, int fd, struct statx *statx_buf, uint64_t tag);
+
+// Read up to 'len' bytes at 'offset' in 'fd' into registered buffer 'index', starting
+// 'buffer_offset' bytes into it, as pread would
+int io_ring_queue_read(io_ring_t *ring, int fd, unsigned index, size_t buffer_offset,
+                       size_t len, off_t offset, uint64_t tag);
+
+// Write 'len' bytes from registered buffer 'index', starting 'buffer_offset' bytes into it,
+// at 'offset' in 'fd', as pwrite would
+int io_ring_queue_write(io_ring_t *ring, int fd, unsigned index, size_t buffer_offset,
+                        size_t len, off_t offset, uint64_t tag);
+
+// Close 'fd'
+int io_ring_queue_close(io_ring_t *ring, int fd, uint64_t tag);
+
+// Hands every queued operation to the kernel, then waits until at least one result is
+// ready, unless one already is or nothing is in flight
+// Returns 0 on success or -1 if an error occurs
+int io_ring_wait(io_ring_t *ring);
+
+// Takes the next ready result
+// Returns 1 with 'result' filled in, or 0 if no result is ready
+int io_ring_next(io_ring_t *ring, io_ring_result_t *result);
+
+// Returns the number of operations queued whose results have not been taken yet
+unsigned io_ring_pending(const io_ring_t *ring);
+
+// Waits for any operations still in flight, dropping their results, then releases the ring
+void io_ring_free(io_ring_t *ring);
+
+#endif    // _IO_RING_H
@@ -0,0 +1,101 @@
+#define _GNU_SOURCE
+#include "member_filter.h"
+
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A match may stop at a slash, leaving the rest of the name beneath the matched directory.
+#define MATCH_FLAGS FNM_LEADING_DIR
+
+void member_filter_init(member_filter_t *filter) {
+    memset(filter, 0, sizeof(member_filter_t));
+}
+
+int member_filter_add(member_filter_t *filter, const char *pattern, int exclude) {
+    char ***patterns = exclude ? &filter->excludes : &filter->includes;
+    size_t *count = exclude ? &filter->num_excludes : &filter->num_includes;
+
+    char *copy = strdup(pattern);
+    char **grown = realloc(*patterns, (*count + 1) * sizeof(char *));
+    if (copy == NULL || grown == NULL) {
+        perror("Failed to add pattern");
+        free(copy);
+        if (grown != NULL) {
+            *patterns = grown;
+        }
+        return -1;
+    }
+    size_t len = strlen(copy);
+    while (len > 1 && copy[len - 1] == '/') {
+        copy[--len] = '\0';
+    }
+    grown[(*count)++] = copy;
+    *patterns = grown;
+    return 0;
+}
+
+int member_filter_active(const member_filter_t *filter) {
+    return filter->num_includes > 0 || filter->num_excludes > 0;
+}
+
+// Returns 1 If 'name' Matches Any Of The 'count' Patterns In 'patterns'.
+// A Directory Member's Trailing Slash Is Left Out Of The Match.
+static int match_any(char *const *patterns, size_t count, const char *name) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t len = strlen(name);
+    char *trimmed = NULL;
+    if (len > 1 && name[len - 1] == '/') {
+        trimmed = strndup(name, len - 1);
+        if (trimmed != NULL) {
+            name = trimmed;
+        }
+    }
+
+    int matched = 0;
+    for (size_t i = 0; i < count && !matched; i++) {
+        matched = fnmatch(patterns[i], name, MATCH_FLAGS) == 0;
+    }
+    free(trimmed);
+    return matched;
+}
+
+int member_filter_match(const member_filter_t *filter, const char *name) {
+    if (filter->num_includes > 0 && !match_any(filter->includes, filter->num_includes, name)) {
+        return 0;
+    }
+    return !match_any(filter->excludes, filter->num_excludes, name);
+}
+
+int member_filter_excluded(const member_filter_t *filter, const char *name) {
+    return match_any(filter->excludes, filter->num_excludes, name);
+}
+
+size_t member_filter_prefix_len(const member_filter_t *filter, size_t i) {
+    // Backslashes Escape The Next Character, So They End The Literal Part Too.
+    return strcspn(filter->includes[i], "*?[\\");
+}
+
+int member_filter_has_prefixes(const member_filter_t *filter) {
+    for (size_t i = 0; i < filter->num_includes; i++) {
+        if (member_filter_prefix_len(filter, i) == 0) {
+            return 0;
+        }
+    }
+    return filter->num_includes > 0;
+}
+
+void member_filter_clear(member_filter_t *filter) {
+    for (size_t i = 0; i < filter->num_includes; i++) {
+        free(filter->includes[i]);
+    }
+    for (size_t i = 0; i < filter->num_excludes; i++) {
+        free(filter->excludes[i]);
+    }
+    free(filter->includes);
+    free(filter->excludes);
+    member_filter_init(filter);
+}
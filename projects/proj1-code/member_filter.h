@@ -0,0 +1,47 @@
+#ifndef _MEMBER_FILTER_H
+#define _MEMBER_FILTER_H
+
+#include <stddef.h>
+
+// Include and exclude patterns (--include/--exclude) picking out the members an operation
+// works on. Patterns are shell globs matched with fnmatch against the whole name, where '*'
+// also matches '/', and a pattern that matches a directory matches everything beneath it.
+// A member passes if it matches any include pattern (or there are none) and no exclude
+// pattern.
+typedef struct {
+    char **includes;
+    size_t num_includes;
+    char **excludes;
+    size_t num_excludes;
+} member_filter_t;
+
+// Initialize a new filter that lets everything through
+void member_filter_init(member_filter_t *filter);
+
+// Add a copy of 'pattern' to the include patterns, or to the exclude patterns if 'exclude'
+// is set. Trailing slashes are dropped, so "dir/" means the same as "dir".
+// Returns 0 on success or -1 if an error occurs
+int member_filter_add(member_filter_t *filter, const char *pattern, int exclude);
+
+// Returns 1 if the filter has any patterns at all, 0 if it lets everything through
+int member_filter_active(const member_filter_t *filter);
+
+// Returns 1 if the member or path 'name' passes the filter, 0 if not
+int member_filter_match(const member_filter_t *filter, const char *name);
+
+// Returns 1 if 'name' matches an exclude pattern (and so does everything beneath it), 0 if
+// not
+int member_filter_excluded(const member_filter_t *filter, const char *name);
+
+// Returns the length of the literal text the i-th include pattern starts with, before any
+// wildcard, which every name it matches must also start with
+size_t member_filter_prefix_len(const member_filter_t *filter, size_t i);
+
+// Returns 1 if every include pattern starts with some literal text (and there is at least
+// one), so only names starting with one of those prefixes can pass
+int member_filter_has_prefixes(const member_filter_t *filter);
+
+// Free any memory associated with the filter and leave it letting everything through
+void member_filter_clear(member_filter_t *filter);
+
+#endif    // _MEMBER_FILTER_H
@@ -1,30 +1,173 @@
+#define _GNU_SOURCE
 #include "minitar.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "archive_index.h"
+#include "block_checksum.h"
+#include "compress_stream.h"
+#include "io_ring.h"
+#include "member_filter.h"
+#include "sparse_map.h"
+#include "tree_walk.h"
+
 #define NUM_TRAILING_BLOCKS 2
 #define MAX_MSG_LEN 128
-#define BLOCK_SIZE 512
+#define LOOKUP_BUF_LEN 4096
 #define OCTAL_BASE 8
+#define DEFAULT_BUFFER_SIZE (1 << 20)
+#define BUFFER_ALIGNMENT 4096
+#define MAX_OCTAL_FIELD_LEN 12
+#define SLOTS_PER_JOB 2
+#define NAME_CACHE_SIZE 16
+#define NAME_FIELD_LEN 32
+
+// States of a member slot when creating an archive in parallel (or with --io-uring, where
+// a slot is SLOT_LOADING while its operations are under way)
+#define SLOT_EMPTY 0
+#define SLOT_READY 1
+#define SLOT_FAILED 2
+#define SLOT_LOADING 3
+
+// With --io-uring, members in flight at once, each with a registered buffer of its own,
+// and the depth of the ring, as a member never has more than two operations in flight
+#define RING_SLOTS 32
+#define RING_DEPTH (2 * RING_SLOTS)
+#define RING_BUFFER_SIZE (64 << 10)
+
+// The tag of a ring operation holds the number of its slot above the kind of operation
+#define RING_TAG_SHIFT 8
+#define RING_TAG_OP_MASK 0xff
+#define RING_OP_OPEN 0
+#define RING_OP_STAT 1
+#define RING_OP_READ 2
+#define RING_OP_WRITE 3
+#define RING_OP_CLOSE 4
 
 // Constants for tar compatibility information
 #define MAGIC "ustar"
 
 // Constants to represent different file types
-// We'll only use regular files in this project
+// Regular files, plus directories when a directory is archived recursively
 #define REGTYPE '0'
 #define DIRTYPE '5'
 
+// Extended headers that describe the member following them, rather than being members
+// PAX per-file and global headers hold "<length> <key>=<value>\n" records, and GNU long
+// name/link headers hold a single null-terminated name
+#define PAX_HEADER_TYPE 'x'
+#define PAX_GLOBAL_TYPE 'g'
+#define GNU_LONGNAME_TYPE 'L'
+#define GNU_LONGLINK_TYPE 'K'
+
+// Longest member name, including the slash added to a directory and the null terminator
+#define MEMBER_NAME_MAX (PATH_MAX + 1)
+// Room for a PAX header's records, padded out to whole blocks
+#define PAX_DATA_MAX ((MEMBER_NAME_MAX + 160) / BLOCK_SIZE + 1) * BLOCK_SIZE
+// Directory GNU tar puts in the header name of a sparse member, whose real name is
+// carried by its PAX header
+#define SPARSE_NAME_DIR "GNUSparseFile.0/"
+
+minitar_options_t minitar_opts = {
+    .buffer_size = DEFAULT_BUFFER_SIZE,
+    .num_jobs = 1,
+};
+
+minitar_stats_t minitar_stats;
+
+// Owner or group names recently looked up, keyed by numeric ID
+// Archived files almost always share a handful of owners, so a small table avoids
+// going through NSS (and possibly a network directory service) once per file
+typedef struct {
+    unsigned ids[NAME_CACHE_SIZE];
+    char names[NAME_CACHE_SIZE][NAME_FIELD_LEN];
+    int count;
+    int next_victim;
+} name_cache_t;
+
+// Both caches live for the whole process, so repeated create/append runs share them
+static name_cache_t uname_cache;
+static name_cache_t gname_cache;
+static pthread_mutex_t name_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Large, aligned buffer used to move member contents many blocks at a time
+typedef struct {
+    char *data;
+    size_t size;
+} copy_buffer_t;
+
+void print_stats(FILE *out) {
+    fprintf(out, "minitar: skipped %zu superseded member versions (%zu bytes)\n",
+            minitar_stats.superseded_members, minitar_stats.superseded_bytes);
+    fprintf(out, "minitar: skipped %zu unchanged files\n", minitar_stats.unchanged_files);
+    fprintf(out, "minitar: verified %zu header checksums\n", minitar_stats.verified_headers);
+    fprintf(out, "minitar: stored %zu sparse files, leaving out %zu bytes of holes\n",
+            minitar_stats.sparse_members, minitar_stats.hole_bytes);
+    fprintf(out, "minitar: jumped ahead to a later compressed frame %zu times\n",
+            minitar_stats.frame_jumps);
+    fprintf(out, "minitar: owner/group name cache: %zu hits, %zu misses\n",
+            minitar_stats.name_cache_hits, minitar_stats.name_cache_misses);
+    fprintf(out, "minitar: completed %zu file operations through io_uring\n",
+            minitar_stats.ring_operations);
+}
+
+/*
+ * Copies the cached name for 'id' into the header field 'field'.
+ * Returns 1 if the name was cached or 0 if it must be looked up
+ */
+static int name_cache_find(name_cache_t *cache, unsigned id, char *field) {
+    int found = 0;
+    pthread_mutex_lock(&name_cache_lock);
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->ids[i] == id) {
+            memcpy(field, cache->names[i], NAME_FIELD_LEN);
+            found = 1;
+            break;
+        }
+    }
+    if (found) {
+        minitar_stats.name_cache_hits++;
+    } else {
+        minitar_stats.name_cache_misses++;
+    }
+    pthread_mutex_unlock(&name_cache_lock);
+    return found;
+}
+
+/*
+ * Remembers the header field 'field' as the name for 'id'.
+ * Once the cache is full, entries are replaced round robin
+ */
+static void name_cache_store(name_cache_t *cache, unsigned id, const char *field) {
+    pthread_mutex_lock(&name_cache_lock);
+    int slot;
+    if (cache->count < NAME_CACHE_SIZE) {
+        slot = cache->count++;
+    } else {
+        slot = cache->next_victim;
+        cache->next_victim = (cache->next_victim + 1) % NAME_CACHE_SIZE;
+    }
+    cache->ids[slot] = id;
+    memcpy(cache->names[slot], field, NAME_FIELD_LEN);
+    pthread_mutex_unlock(&name_cache_lock);
+}
+
 /*
  * Helper function to compute the checksum of a tar header block
  * Performs a simple sum over all bytes in the header in accordance with POSIX
@@ -33,12 +176,223 @@
 void compute_checksum(tar_header *header) {
     // Have to initially set header's checksum to "all blanks"
     memset(header->chksum, ' ', 8);
+    block_sums_t sums;
+    block_checksum(header, &sums);
+    snprintf(header->chksum, 8, "%07o", (unsigned) sums.signed_sum);
+}
+
+// Header fields that are the same for every member, with the checksum field blank
+static const tar_header header_template = {
+    .chksum = {' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '},
+    .typeflag = REGTYPE,    // File type, regular file unless a directory
+    .magic = MAGIC,         // Special, standardized sequence of bytes
+    .version = {'0', '0'},  // A bit weird, sidesteps null termination
+};
+
+// Byte sum of 'header_template', the starting point for every member's checksum
+#define HEADER_TEMPLATE_SUM                                                                   \
+    (8 * ' ' + REGTYPE + 'u' + 's' + 't' + 'a' + 'r' + '0' + '0')
+
+/*
+ * Sums the bytes of a header field the same way compute_checksum does (as plain chars)
+ */
+static unsigned field_sum(const char *field, size_t len) {
+    unsigned sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += field[i];
+    }
+    return sum;
+}
+
+/*
+ * Writes 'value' into the header field 'field' of 'width' bytes as 0-padded octal, exactly
+ * as snprintf(field, width, "%0<width - 1>o", value) would.
+ * Returns the byte sum of the digits written, for the header checksum
+ */
+static unsigned encode_octal(char *field, size_t width, unsigned long value) {
+    size_t digits = width - 1;
+    if (value >> (3 * digits) != 0) {
+        // Too wide for the field, let snprintf truncate it like it always has
+        snprintf(field, width, "%0*lo", (int) digits, value);
+        return field_sum(field, width);
+    }
+
+    // Fixed number of digits and no data-dependent branches, so the loop is fully unrolled
     unsigned sum = 0;
-    char *bytes = (char *) header;
-    for (int i = 0; i < sizeof(tar_header); i++) {
-        sum += bytes[i];
+    for (size_t i = digits; i-- > 0;) {
+        field[i] = '0' + (value & 7);
+        sum += field[i];
+        value >>= 3;
+    }
+    field[digits] = '\0';
+    return sum;
+}
+
+/*
+ * Writes 'value' into the numeric header field 'field' of 'width' bytes. Values that fit
+ * are written as 0-padded octal, exactly as encode_octal does. Anything else (sizes of 8 GiB
+ * and up, times before 1970, very large IDs) uses the GNU base-256 form instead: the
+ * value in big-endian two's complement, with the top bit of the first byte set as a marker.
+ * Returns the byte sum of the field, for the header checksum
+ */
+static unsigned encode_numeric(char *field, size_t width, int64_t value) {
+    if (value >= 0 && (uint64_t) value >> (3 * (width - 1)) == 0) {
+        return encode_octal(field, width, value);
+    }
+
+    uint64_t bits = value;
+    for (size_t i = width; i-- > 0;) {
+        field[i] = bits & 0xff;
+        // Shift Through A Signed Value So Negative Numbers Keep Their Sign Bits.
+        bits = (uint64_t) ((int64_t) bits >> 8);
+    }
+    field[0] = value < 0 ? 0xff : 0x80;
+    return field_sum(field, width);
+}
+
+/*
+ * Copies the string 'src' into the zero-filled header field 'field' of 'len' bytes,
+ * like strncpy. Returns the byte sum of the characters copied
+ */
+static unsigned copy_field(char *field, const char *src, size_t len) {
+    size_t n = strnlen(src, len);
+    memcpy(field, src, n);
+    return field_sum(field, n);
+}
+
+/*
+ * Writes the member name for the file 'file_name' into 'member_name' (MEMBER_NAME_MAX
+ * bytes), adding a trailing slash when the file is a directory.
+ * Returns the length of the name, or -1 if it is too long
+ */
+static ssize_t format_member_name(const char *file_name, int is_dir, char *member_name) {
+    size_t name_len = strlen(file_name);
+    int add_slash = is_dir && (name_len == 0 || file_name[name_len - 1] != '/');
+    if (name_len + add_slash >= MEMBER_NAME_MAX) {
+        fprintf(stderr, "File name too long: %s\n", file_name);
+        return -1;
+    }
+    memcpy(member_name, file_name, name_len);
+    if (add_slash) {
+        member_name[name_len++] = '/';
+    }
+    member_name[name_len] = '\0';
+    return name_len;
+}
+
+/*
+ * Finds where the member name 'name' can be split between the ustar prefix and name fields
+ * (the slash at the split is implied, not stored).
+ * Returns the length of the prefix, 0 if the name fits in the name field alone, or -1 if
+ * it fits neither way and needs an extended header
+ */
+static ssize_t ustar_prefix_len(const char *name, size_t name_len) {
+    if (name_len <= sizeof(((tar_header *) 0)->name)) {
+        return 0;
+    }
+
+    // The Rightmost Usable Slash Leaves The Shortest Name Part, Which Must Not Be Empty.
+    size_t i = name_len - 2;
+    if (i > sizeof(((tar_header *) 0)->prefix)) {
+        i = sizeof(((tar_header *) 0)->prefix);
+    }
+    for (; i > 0; i--) {
+        if (name[i] == '/') {
+            return name_len - i - 1 <= sizeof(((tar_header *) 0)->name) ? (ssize_t) i : -1;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Populates a tar header block pointed to by 'header' with the metadata 'stat_buf' of
+ * the file identified by 'file_name'.
+ * The header starts from a prebuilt template and the checksum is accumulated as each field
+ * is written, so the result matches compute_checksum without a second pass over the block.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int fill_tar_header_from_stat(tar_header *header, const char *file_name,
+                              const struct stat *stat_buf) {
+    *header = header_template;
+    unsigned sum = HEADER_TEMPLATE_SUM;
+    char err_msg[MAX_MSG_LEN];
+
+    // Directories Are Stored As Empty Members Whose Names End In A Slash.
+    int is_dir = S_ISDIR(stat_buf->st_mode);
+    char member_name[MEMBER_NAME_MAX];
+    ssize_t name_len = format_member_name(file_name, is_dir, member_name);
+    if (name_len < 0) {
+        return -1;
+    }
+
+    // Name of the file, null-terminated string
+    // A name longer than the name field is split across the prefix and name fields if it
+    // can be, otherwise it is cut short here and write_member_header stores it in full
+    ssize_t prefix_len = ustar_prefix_len(member_name, name_len);
+    if (prefix_len > 0) {
+        sum += copy_field(header->prefix, member_name, prefix_len);
+        sum += copy_field(header->name, member_name + prefix_len + 1, sizeof(header->name));
+    } else {
+        sum += copy_field(header->name, member_name, sizeof(header->name));
+    }
+    if (is_dir) {
+        header->typeflag = DIRTYPE;
+        sum += DIRTYPE - REGTYPE;
+    }
+    // Permissions for file, 0-padded octal
+    sum += encode_octal(header->mode, sizeof(header->mode), stat_buf->st_mode & 07777);
+    // Owner ID of the file, 0-padded octal
+    sum += encode_numeric(header->uid, sizeof(header->uid), stat_buf->st_uid);
+
+    // Look up name corresponding to owner ID
+    // The reentrant lookups are used since headers may be filled by several threads at once
+    // Failed lookups are not cached, so every file with an unknown owner still reports an error
+    char lookup_buf[LOOKUP_BUF_LEN];
+    if (!name_cache_find(&uname_cache, stat_buf->st_uid, header->uname)) {
+        struct passwd pwd_buf, *pwd;
+        int lookup_err =
+            getpwuid_r(stat_buf->st_uid, &pwd_buf, lookup_buf, LOOKUP_BUF_LEN, &pwd);
+        if (pwd == NULL) {
+            errno = lookup_err;
+            snprintf(err_msg, MAX_MSG_LEN, "Failed to look up owner name of file %s", file_name);
+            perror(err_msg);
+            return -1;
+        }
+        // Owner name of the file, null-terminated string
+        strncpy(header->uname, pwd->pw_name, NAME_FIELD_LEN);
+        name_cache_store(&uname_cache, stat_buf->st_uid, header->uname);
+    }
+    sum += field_sum(header->uname, NAME_FIELD_LEN);
+
+    // Group ID of the file, 0-padded octal
+    sum += encode_numeric(header->gid, sizeof(header->gid), stat_buf->st_gid);
+    // Look up name corresponding to group ID
+    if (!name_cache_find(&gname_cache, stat_buf->st_gid, header->gname)) {
+        struct group grp_buf, *grp;
+        int lookup_err =
+            getgrgid_r(stat_buf->st_gid, &grp_buf, lookup_buf, LOOKUP_BUF_LEN, &grp);
+        if (grp == NULL) {
+            errno = lookup_err;
+            snprintf(err_msg, MAX_MSG_LEN, "Failed to look up group name of file %s", file_name);
+            perror(err_msg);
+            return -1;
+        }
+        // Group name of the file, null-terminated string
+        strncpy(header->gname, grp->gr_name, NAME_FIELD_LEN);
+        name_cache_store(&gname_cache, stat_buf->st_gid, header->gname);
     }
-    snprintf(header->chksum, 8, "%07o", sum);
+    sum += field_sum(header->gname, NAME_FIELD_LEN);
+
+    // File size, 0-padded octal (base-256 from 8 GiB up)
+    sum += encode_numeric(header->size, sizeof(header->size), is_dir ? 0 : stat_buf->st_size);
+    // Modification time, 0-padded octal
+    sum += encode_numeric(header->mtime, sizeof(header->mtime), stat_buf->st_mtime);
+    // Major and minor device numbers, 0-padded octal
+    sum += encode_octal(header->devmajor, sizeof(header->devmajor), major(stat_buf->st_dev));
+    sum += encode_octal(header->devminor, sizeof(header->devminor), minor(stat_buf->st_dev));
+
+    encode_octal(header->chksum, sizeof(header->chksum), sum);
+    return 0;
 }
 
 /*
@@ -47,7 +401,6 @@ void compute_checksum(tar_header *header) {
  * Returns 0 on success or -1 if an error occurs
  */
 int fill_tar_header(tar_header *header, const char *file_name) {
-    memset(header, 0, sizeof(tar_header));
     char err_msg[MAX_MSG_LEN];
     struct stat stat_buf;
     // stat is a system call to inspect file metadata
@@ -56,42 +409,126 @@ int fill_tar_header(tar_header *header, const char *file_name) {
         perror(err_msg);
         return -1;
     }
+    return fill_tar_header_from_stat(header, file_name, &stat_buf);
+}
+
+// Directory of the member most recently opened by one thread. When the next member lives in
+// the same directory it is opened relative to a descriptor for it, so the directory's path
+// is not walked again for every file
+typedef struct {
+    char path[PATH_MAX];
+    int fd;    // -1 until a second member from 'path' comes along
+} member_dir_t;
+
+void member_dir_init(member_dir_t *dir) {
+    dir->path[0] = '\0';
+    dir->fd = -1;
+}
+
+void member_dir_close(member_dir_t *dir) {
+    if (dir->fd != -1) {
+        close(dir->fd);
+    }
+    member_dir_init(dir);
+}
+
+/*
+ * Opens the file 'file_name' for reading, relative to the cached directory in 'dir' when
+ * the file lives there.
+ * Returns the new file descriptor, or -1 with errno set
+ */
+int open_member_fd(member_dir_t *dir, const char *file_name) {
+    const char *slash = strrchr(file_name, '/');
+    if (slash == NULL || slash == file_name || slash - file_name >= PATH_MAX) {
+        return open(file_name, O_RDONLY);
+    }
+
+    size_t dir_len = slash - file_name;
+    if (strncmp(dir->path, file_name, dir_len) != 0 || dir->path[dir_len] != '\0') {
+        // A New Directory, Remembered In Case The Next Member Shares It.
+        member_dir_close(dir);
+        memcpy(dir->path, file_name, dir_len);
+        dir->path[dir_len] = '\0';
+        return open(file_name, O_RDONLY);
+    }
+
+    if (dir->fd == -1) {
+        dir->fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir->fd == -1) {
+            return open(file_name, O_RDONLY);
+        }
+    }
+    return openat(dir->fd, slash + 1, O_RDONLY);
+}
 
-    strncpy(header->name, file_name, 100);    // Name of the file, null-terminated string
-    snprintf(header->mode, 8, "%07o",
-             stat_buf.st_mode & 07777);    // Permissions for file, 0-padded octal
+/*
+ * Turns the header of the file 'file_name' into that of a sparse member laid out by
+ * 'sparse': the size becomes that of the map plus the file's data, and the name field
+ * holds a placeholder, as the real name goes in the member's PAX header.
+ */
+static void fill_sparse_header(tar_header *header, const char *file_name,
+                               const sparse_map_t *sparse) {
+    const char *base_name = strrchr(file_name, '/');
+    base_name = base_name != NULL ? base_name + 1 : file_name;
+    memset(header->name, 0, sizeof(header->name));
+    memset(header->prefix, 0, sizeof(header->prefix));
+    snprintf(header->name, sizeof(header->name), "%s%s", SPARSE_NAME_DIR, base_name);
+    encode_numeric(header->size, sizeof(header->size),
+                   sparse_map_encoded_size(sparse) + sparse->data_size);
+    compute_checksum(header);
+}
 
-    snprintf(header->uid, 8, "%07o", stat_buf.st_uid);    // Owner ID of the file, 0-padded octal
-    struct passwd *pwd = getpwuid(stat_buf.st_uid);       // Look up name corresponding to owner ID
-    if (pwd == NULL) {
-        snprintf(err_msg, MAX_MSG_LEN, "Failed to look up owner name of file %s", file_name);
+/*
+ * Opens the file 'file_name' once, taking its metadata for 'header' from the open
+ * descriptor, and returns the stream its contents are then copied from in '*input_file'.
+ * With minitar_opts.sparse set, a file with holes gets its data segments recorded in
+ * 'sparse' and a sparse member header; otherwise 'sparse' is left empty.
+ * Returns 0 on success or -1 if an error occurs
+ */
+int open_member(member_dir_t *dir, const char *file_name, tar_header *header,
+                sparse_map_t *sparse, FILE **input_file) {
+    char err_msg[MAX_MSG_LEN];
+    int fd = open_member_fd(dir, file_name);
+    if (fd == -1) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to open file %s", file_name);
         perror(err_msg);
         return -1;
     }
-    strncpy(header->uname, pwd->pw_name, 32);    // Owner name of the file, null-terminated string
 
-    snprintf(header->gid, 8, "%07o", stat_buf.st_gid);    // Group ID of the file, 0-padded octal
-    struct group *grp = getgrgid(stat_buf.st_gid);        // Look up name corresponding to group ID
-    if (grp == NULL) {
-        snprintf(err_msg, MAX_MSG_LEN, "Failed to look up group name of file %s", file_name);
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) != 0) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to stat file %s", file_name);
         perror(err_msg);
+        close(fd);
+        return -1;
+    }
+    if (fill_tar_header_from_stat(header, file_name, &stat_buf) != 0) {
+        perror("Failed to fill tar header");
+        close(fd);
         return -1;
     }
-    strncpy(header->gname, grp->gr_name, 32);    // Group name of the file, null-terminated string
 
-    snprintf(header->size, 12, "%011o",
-             (unsigned) stat_buf.st_size);    // File size, 0-padded octal
-    snprintf(header->mtime, 12, "%011o",
-             (unsigned) stat_buf.st_mtime);    // Modification time, 0-padded octal
-    header->typeflag = REGTYPE;                // File type, always regular file in this project
-    strncpy(header->magic, MAGIC, 6);          // Special, standardized sequence of bytes
-    memcpy(header->version, "00", 2);          // A bit weird, sidesteps null termination
-    snprintf(header->devmajor, 8, "%07o",
-             major(stat_buf.st_dev));    // Major device number, 0-padded octal
-    snprintf(header->devminor, 8, "%07o",
-             minor(stat_buf.st_dev));    // Minor device number, 0-padded octal
+    // Only A File With Fewer Blocks Allocated Than Its Size Needs Can Have Holes, So Dense
+    // Files Cost No Extra System Calls.
+    sparse->count = 0;
+    if (minitar_opts.sparse && S_ISREG(stat_buf.st_mode) &&
+        (uint64_t) stat_buf.st_blocks * BLOCK_SIZE < (uint64_t) stat_buf.st_size) {
+        int scan_status = sparse_map_scan(sparse, fd, stat_buf.st_size);
+        if (scan_status == -1) {
+            close(fd);
+            return -1;
+        }
+        if (scan_status == 1) {
+            fill_sparse_header(header, file_name, sparse);
+        }
+    }
 
-    compute_checksum(header);
+    *input_file = fdopen(fd, "r");
+    if (*input_file == NULL) {
+        perror("Failed to open file");
+        close(fd);
+        return -1;
+    }
     return 0;
 }
 
@@ -150,20 +587,6 @@ int convert_octal_to_size_t(const char *octal_string, size_t *size) {
     return 0;
 }
 
-// Writes The Padding (of BLOCK_SIZE) To The Archive.
-int write_file_padding(FILE *tar_archive, size_t padding) {
-    char padding_buffer[BLOCK_SIZE] = {0};
-
-    // Write The Padding To The Archive.
-    // Else If The Padding Is Not Written, Return An Error.
-    if (fwrite(padding_buffer, 1, padding, tar_archive) != padding) {
-        perror("Failed to write to tar archive");
-        return -1;
-    }
-
-    return 0;
-}
-
 // Writes The Footer (Two Empty Blocks) To The Archive.
 int write_footer(FILE *tar_archive) {
     // Add Two Empty Blocks (Footer) To The End Of The Archive.
@@ -180,39 +603,65 @@ int write_footer(FILE *tar_archive) {
     return 0;
 }
 
+// Allocates The Copy Buffer Shared By Create, Append And Extract.
+// The Buffer Is Page Aligned And Holds Many Tar Blocks, So Each fread/fwrite Moves
+// minitar_opts.buffer_size Bytes Instead Of A Single 512 Byte Block.
+int copy_buffer_init(copy_buffer_t *buffer) {
+    size_t size = minitar_opts.buffer_size;
+    if (size < BLOCK_SIZE || size % BLOCK_SIZE != 0) {
+        fprintf(stderr, "Invalid buffer size %zu, must be a multiple of %d\n", size, BLOCK_SIZE);
+        return -1;
+    }
+
+    void *data;
+    int err = posix_memalign(&data, BUFFER_ALIGNMENT, size);
+    if (err != 0) {
+        errno = err;
+        perror("Failed to allocate copy buffer");
+        return -1;
+    }
+
+    buffer->data = data;
+    buffer->size = size;
+    return 0;
+}
+
+// Releases The Memory Held By A Copy Buffer.
+void copy_buffer_free(copy_buffer_t *buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+}
+
 // Writes The File Contents To The Archive.
-int write_file_contents(FILE *tar_archive, FILE *input_file) {
-    char buffer[BLOCK_SIZE] = {0};
+int write_file_contents(FILE *tar_archive, FILE *input_file, copy_buffer_t *buffer) {
     size_t bytes_fetched;
 
-    // Read The File Contents In Blocks Of 512 Bytes.
-    // If Bytes Fetched is 0, We Have Reached The End Of The File.
-    while ((bytes_fetched = fread(buffer, 1, BLOCK_SIZE, input_file)) > 0) {
-        // Write The File Contents To The Archive.
-        size_t bytes_written = fwrite(buffer, 1, bytes_fetched, tar_archive);
+    // Read The File Contents In Chunks Of buffer->size Bytes.
+    // fread Only Comes Back Short At The End Of The File (Or On Error), So Only The Last
+    // Chunk Can End In A Partial Block.
+    while ((bytes_fetched = fread(buffer->data, 1, buffer->size, input_file)) > 0) {
+        size_t bytes_to_write = bytes_fetched;
 
-        // If The Bytes Written Is Not Equal To The Bytes Fetched, Return An Error.
-        if (bytes_written != bytes_fetched) {
-            perror("Failed to write to tar archive");
-            return -1;
+        // If The Last Chunk Ends In A Partial Block, We need to add padding.
+        // The Zeros Are Placed Directly After The Data, So They Go Out In The Same fwrite
+        // (following the tar format).
+        if (bytes_fetched % BLOCK_SIZE != 0) {
+            size_t padding = BLOCK_SIZE - (bytes_fetched % BLOCK_SIZE);
+            memset(buffer->data + bytes_fetched, 0, padding);
+            bytes_to_write += padding;
         }
 
-        // If The File Contents is Less Than 512 Bytes, We need to add padding.
-        // This ensures that the file contents are written in blocks of 512 bytes (following the
-        // tar format).
-        if (bytes_fetched < BLOCK_SIZE) {
-            size_t padding = BLOCK_SIZE - bytes_fetched;
-
-            // Write The Padding To The Archive.
-            if (write_file_padding(tar_archive, padding) != 0) {
-                return -1;
-            }
+        // Write The File Contents To The Archive.
+        // If The Bytes Written Is Not Equal To The Bytes To Write, Return An Error.
+        if (fwrite(buffer->data, 1, bytes_to_write, tar_archive) != bytes_to_write) {
+            perror("Failed to write to tar archive");
+            return -1;
         }
     }
 
     // Check If The fread Function Failed To Read The File.
-    // If The Bytes Fetched Is 0 And ferror Returns An Error, Return An Error.
-    if (bytes_fetched == 0 && ferror(input_file) != 0) {
+    if (ferror(input_file) != 0) {
         perror("Failed to read file");
         return -1;
     }
@@ -220,330 +669,3585 @@ int write_file_contents(FILE *tar_archive, FILE *input_file) {
     return 0;
 }
 
-int create_archive(const char *archive_name, const file_list_t *files) {
-    // Create A New Tar Archive with Write Binary Permissions.
-    FILE *tar_archive = fopen(archive_name, "wb");
-    if (tar_archive == NULL) {
-        perror("Failed to create tar archive");
+// Copies The File Contents Into The Archive Inside The Kernel, Without Passing Through
+// Our Buffers. Tries copy_file_range First And Falls Back To sendfile, Then Writes The
+// Padding With A Single pwrite.
+// Returns 0 on success, -1 on error, or 1 if neither syscall is supported for this pair of
+// files (nothing has been copied, so the caller can use write_file_contents instead).
+int write_file_contents_kernel(FILE *tar_archive, FILE *input_file) {
+    static const char zero_block[BLOCK_SIZE] = {0};
+
+    // A Compressed Archive Is A Stream Without An fd, So The Kernel Cannot Copy Into It.
+    if (fileno(tar_archive) == -1) {
+        return 1;
+    }
+
+    // Flush Anything Still Buffered By stdio, So The Archive fd Is Up To Date.
+    if (fflush(tar_archive) != 0) {
+        perror("Failed to write to tar archive");
         return -1;
     }
 
-    // Setting Current File
-    node_t *curr_file = files->head;
+    // Neither Can It Copy To The Offset Of A Pipe, Which Has None.
+    off_t archive_offset = ftello(tar_archive);
+    if (archive_offset == -1) {
+        return 1;
+    }
 
-    // Iterate Through The Files To Be Added To The Archive.
-    while (curr_file != NULL) {
-        tar_header archive_header;
+    int archive_fd = fileno(tar_archive);
+    int input_fd = fileno(input_file);
+    struct stat stat_buf;
+    if (fstat(input_fd, &stat_buf) != 0) {
+        perror("Failed to stat file");
+        return -1;
+    }
 
-        // Filling The Header
-        // Handle Errors If The Header Is Not Filled.
-        int header_status = fill_tar_header(&archive_header, curr_file->name);
-        if (header_status == -1) {
-            perror("Failed to fill tar header");
-            close_file(tar_archive, "Failed to close tar archive");
-            return -1;
-        }
+    off_t input_offset = 0;
+    off_t file_size = stat_buf.st_size;
+    int use_sendfile = 0;
 
-        // Write The Header To The Archive.
-        // If The Header Is Not Written, Return An Error.
-        size_t write_to_header = fwrite(&archive_header, sizeof(tar_header), 1, tar_archive);
-        if (write_to_header != 1) {
-            perror("Failed to write to tar archive");
-            close_file(tar_archive, "Failed to close tar archive");
-            return -1;
+    while (input_offset < file_size) {
+        size_t bytes_to_copy = file_size - input_offset;
+        ssize_t bytes_copied;
+        if (!use_sendfile) {
+            bytes_copied = copy_file_range(input_fd, &input_offset, archive_fd, &archive_offset,
+                                           bytes_to_copy, 0);
+        } else {
+            // sendfile Writes At The Archive fd's Own Position, Which We Keep In Sync.
+            bytes_copied = sendfile(archive_fd, input_fd, &input_offset, bytes_to_copy);
+            if (bytes_copied > 0) {
+                archive_offset += bytes_copied;
+            }
         }
 
-        // Open The Current File To Be Added To The Archive.
-        // Read Only Permisisons.
-        FILE *input_file = fopen(curr_file->name, "r");
-        if (input_file == NULL) {
-            perror("Failed to open file");
-            close_file(tar_archive, "Failed to close tar archive");
+        if (bytes_copied < 0) {
+            // Only An Unsupported First Call Falls Back, Later Failures Are Real I/O Errors.
+            int unsupported = errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                              errno == EOPNOTSUPP || errno == EBADF;
+            if (unsupported && input_offset == 0 && !use_sendfile) {
+                if (lseek(archive_fd, archive_offset, SEEK_SET) == -1) {
+                    perror("Failed to seek in tar archive");
+                    return -1;
+                }
+                use_sendfile = 1;
+                continue;
+            } else if (unsupported && input_offset == 0) {
+                return 1;
+            }
+            perror("Failed to copy file into tar archive");
             return -1;
         }
 
-        // Write/Copy The File Contents To The Archive.
-        if (write_file_contents(tar_archive, input_file) != 0) {
-            close_file(tar_archive, "Failed to close tar archive");
-            close_file(input_file, "Failed to close file");
-            return -1;
+        // The File Shrank While We Were Copying It, Stop At Its New End.
+        if (bytes_copied == 0) {
+            break;
         }
+    }
 
-        // Close The Current File.
-        if (fclose(input_file) != 0) {
-            perror("Failed to close file");
-            close_file(tar_archive, "Failed to close tar archive");
+    // Write The Padding For The Final Partial Block In One pwrite.
+    if (input_offset % BLOCK_SIZE != 0) {
+        size_t padding = BLOCK_SIZE - (input_offset % BLOCK_SIZE);
+        if (pwrite(archive_fd, zero_block, padding, archive_offset) != padding) {
+            perror("Failed to write to tar archive");
             return -1;
         }
-
-        // Move To The Next File.
-        curr_file = curr_file->next;
-    }
-
-    // Write The Footer (Using The Padding Helper)
-    if (write_footer(tar_archive) != 0) {
-        close_file(tar_archive, "Failed to close tar archive");
-        return -1;
+        archive_offset += padding;
     }
 
-    // Close The Tar Archive.
-    if (fclose(tar_archive) != 0) {
-        perror("Failed to close tar archive");
+    // Move The stdio Stream Past Everything The Kernel Wrote On Its Behalf.
+    if (fseeko(tar_archive, archive_offset, SEEK_SET) != 0) {
+        perror("Failed to seek in tar archive");
         return -1;
     }
 
     return 0;
 }
 
-int append_files_to_archive(const char *archive_name, const file_list_t *files) {
-    // Opening The Existing Tar Archive With Read/Write Permissions.
-    // Note: R+B Opens an existing file, and will return NULL if the file does not exist.
-    FILE *tar_archive = fopen(archive_name, "r+b");
-    if (tar_archive == NULL) {
-        perror("Failed to open tar archive");
-        return -1;
-    }
-
-    // Removing The Trailing Bytes / Footer From The Archive.
-    if (remove_trailing_bytes(archive_name, BLOCK_SIZE * NUM_TRAILING_BLOCKS) != 0) {
-        perror("Failed to remove trailing bytes from archive");
-        close_file(tar_archive, "Failed to close tar archive");
-        return -1;
-    }
-
-    // Move The File Pointer To The End Of The Archive.
-    if (fseek(tar_archive, 0, SEEK_END) != 0) {
-        perror("Failed to move file pointer to the end of the archive");
-        close_file(tar_archive, "Failed to close tar archive");
-        return -1;
+// Copies The Body Of A Member ('file_size' Bytes) From The Archive To 'output_file'.
+// The Body Is Read Together With Its Trailing Padding, So The Archive Is Left Positioned At
+// The Next Header Without A Separate Seek.
+int copy_member_contents(FILE *tar_archive, FILE *output_file, size_t file_size,
+                         copy_buffer_t *buffer) {
+    size_t bytes_remaining = file_size;
+    size_t padded_remaining = file_size;
+    if (file_size % BLOCK_SIZE != 0) {
+        padded_remaining += BLOCK_SIZE - (file_size % BLOCK_SIZE);
     }
 
-    // Setting Current File
-    node_t *curr_file = files->head;
-
-    // Iterate Through The Files To Be Added To The Archive.
-    while (curr_file != NULL) {
-        tar_header archive_header;
-
-        // Filling The Header
-        // Handle Errors If The Header Is Not Filled.
-        int header_status = fill_tar_header(&archive_header, curr_file->name);
-        if (header_status == -1) {
-            perror("Failed to fill tar header");
-            close_file(tar_archive, "Failed to close tar archive");
-            return -1;
+    while (padded_remaining > 0) {
+        size_t bytes_to_fetch = padded_remaining;
+        if (bytes_to_fetch > buffer->size) {
+            bytes_to_fetch = buffer->size;
         }
 
-        // Write The Header To The Archive.
-        // If The Header Is Not Written, Return An Error.
-        size_t write_to_header = fwrite(&archive_header, sizeof(tar_header), 1, tar_archive);
-        if (write_to_header != 1) {
-            perror("Failed to write to tar archive");
-            close_file(tar_archive, "Failed to close tar archive");
+        // Read The File Contents (And Any Padding) From The Archive.
+        if (fread(buffer->data, 1, bytes_to_fetch, tar_archive) != bytes_to_fetch) {
+            perror("Failed to read from tar archive");
             return -1;
         }
 
-        // Open The Current File To Be Added To The Archive.
-        // Read Only Permisisons.
-        FILE *input_file = fopen(curr_file->name, "r");
-        if (input_file == NULL) {
-            perror("Failed to open file");
-            close_file(tar_archive, "Failed to close tar archive");
-            return -1;
+        // Write Only The File Contents To The Output File, Never The Padding.
+        size_t bytes_to_write = bytes_remaining;
+        if (bytes_to_write > bytes_to_fetch) {
+            bytes_to_write = bytes_to_fetch;
         }
-
-        // Write/Copy The File Contents To The Archive.
-        if (write_file_contents(tar_archive, input_file) != 0) {
-            close_file(tar_archive, "Failed to close tar archive");
-            close_file(input_file, "Failed to close file");
+        if (fwrite(buffer->data, 1, bytes_to_write, output_file) != bytes_to_write) {
+            perror("Failed to write to file");
             return -1;
         }
 
-        // Close The Current File.
-        if (fclose(input_file) != 0) {
-            perror("Failed to close file");
-            if (fclose(tar_archive) != 0) {
-                perror("Failed to close tar archive");
+        bytes_remaining -= bytes_to_write;
+        padded_remaining -= bytes_to_fetch;
+    }
+
+    return 0;
+}
+
+// Read-only view of an archive used by list and extract.
+// Regular files are memory-mapped and walked as one byte array, with headers parsed in place.
+// Anything that cannot be mapped (e.g. an empty archive) is read through stdio instead, as is
+// a compressed archive, through the decompression stage, which can only go forwards; given
+// the archive's frames, it can still jump ahead by starting again at a later frame. An
+// archive on stdin goes through a stage of its own too, and can only ever go forwards.
+// Names are reassembled into a buffer owned by the reader, which only grows when a longer name
+// comes along, so walking the headers does not allocate per member.
+typedef struct {
+    FILE *stream;             // Set when reading through stdio rather than a mapping
+    int forward_only;         // Set when the stream cannot seek, so skipping reads instead
+    int archive_fd;           // Compressed archive the stream decompresses, or -1
+    compress_type_t compression;
+    const archive_index_t *frames;    // Index holding the compressed archive's frames, if any
+    const char *map;          // The whole archive, when it is memory-mapped
+    size_t map_size;
+    size_t offset;            // Position of the next unread byte in the archive
+    tar_header header_buf;    // Holds the current header for the stdio backend
+    char *name;               // Full name of the current member
+    size_t name_capacity;
+    size_t ext_size;          // Bytes of extended headers in front of the current header
+    int64_t sparse_size;      // Real size of the current member if it is sparse, else -1
+    char *ext_buf;            // Holds an extended header's contents for the stdio backend
+    size_t ext_capacity;
+} archive_reader_t;
+
+// Returns The Size Of A Member Body Once Padded Out To A Whole Number Of Blocks.
+size_t padded_size(size_t file_size) {
+    if (file_size % BLOCK_SIZE == 0) {
+        return file_size;
+    }
+    return file_size + BLOCK_SIZE - (file_size % BLOCK_SIZE);
+}
+
+// Reads A 0-Padded Octal Header Field That May Live In Read-Only Mapped Memory.
+// The Field Is Copied Out So It Can Be Null-Terminated Before Conversion.
+// Fields In The GNU Base-256 Form (Top Bit Of The First Byte Set) Are Decoded Too; A
+// Negative Value Comes Back As Its 64-Bit Two's Complement.
+int parse_octal_field(const char *field, size_t field_len, size_t *value) {
+    const unsigned char *bytes = (const unsigned char *) field;
+    if (bytes[0] & 0x80) {
+        // The Bit Below The Marker Is The Sign, Extended Through The Rest Of The Value.
+        uint64_t sign_bits = bytes[0] & 0x40 ? ~(uint64_t) 0 : 0;
+        uint64_t bits = (sign_bits << 7) | (bytes[0] & 0x7f);
+        for (size_t i = 1; i < field_len; i++) {
+            if ((bits >> 56) != (sign_bits >> 56) ||
+                ((bits >> 55) & 1) != (sign_bits & 1)) {
+                fprintf(stderr, "Failed to read from tar archive: numeric field overflows\n");
+                return -1;
             }
-            return -1;
+            bits = (bits << 8) | bytes[i];
         }
+        *value = bits;
+        return 0;
+    }
+
+    char field_copy[MAX_OCTAL_FIELD_LEN + 1];
+    memcpy(field_copy, field, field_len);
+    field_copy[field_len] = '\0';
 
-        // Move To The Next File.
-        curr_file = curr_file->next;
+    // Other tar Implementations May End The Field With A Space Instead Of A Null.
+    char *space = strchr(field_copy, ' ');
+    if (space != NULL) {
+        *space = '\0';
     }
+    return convert_octal_to_size_t(field_copy, value);
+}
 
-    // Write The Footer
-    if (write_footer(tar_archive) != 0) {
-        close_file(tar_archive, "Failed to close tar archive");
-        return -1;
+// Checks The Checksum Stored In 'header' Against Its Contents.
+// Both The Signed Sum minitar Writes And The Unsigned Sum POSIX Specifies Are Accepted.
+// Returns 0 If It Matches Or -1 If The Header Is Corrupt.
+int verify_header_checksum(const tar_header *header, size_t header_offset) {
+    block_sums_t sums;
+    block_checksum(header, &sums);
+
+    // The Checksum Field Itself Counts As Eight Blanks.
+    for (int i = 0; i < sizeof(header->chksum); i++) {
+        sums.signed_sum += ' ' - header->chksum[i];
+        sums.unsigned_sum += ' ' - (unsigned char) header->chksum[i];
     }
 
-    // Close The Tar Archive.
-    if (fclose(tar_archive) != 0) {
-        perror("Failed to close tar archive");
+    size_t stored_sum;
+    if (parse_octal_field(header->chksum, sizeof(header->chksum), &stored_sum) != 0 ||
+        (stored_sum != sums.unsigned_sum && stored_sum != (unsigned) sums.signed_sum)) {
+        fprintf(stderr, "Failed to read from tar archive: bad checksum in header at offset %zu\n",
+                header_offset);
+        // Callers Report The Failure With perror, So Leave A Reason That Fits.
+        errno = EIO;
         return -1;
     }
-
+    minitar_stats.verified_headers++;
     return 0;
 }
 
-int get_archive_file_list(const char *archive_name, file_list_t *files) {
-    // Opening The Existing Tar Archive With Read Permissions.
-    FILE *tar_archive = fopen(archive_name, "rb");
-    if (tar_archive == NULL) {
-        perror("Failed to open tar archive");
+// Reads The Size Field Of A Header.
+// Base-256 Can Encode A Negative Size, Which Would Wrap Around To A Huge One, So It Is
+// Refused As Corrupt.
+int parse_header_size(const tar_header *header, size_t *size) {
+    if ((header->size[0] & 0xc0) == 0xc0) {
+        fprintf(stderr, "Failed to read from tar archive: negative member size\n");
+        errno = EINVAL;
         return -1;
     }
+    return parse_octal_field(header->size, sizeof(header->size), size);
+}
 
-    tar_header archive_header;
-    size_t bytes_fetched;
+// Records The Member Named 'name' And Described By 'header' (Found At 'header_offset', With
+// 'ext_size' Bytes Of Extended Headers In Front Of It) In The Index.
+// 'sparse_size' Is The Real Size Of A Sparse Member, Or -1 For Any Other Member.
+int index_add_header(archive_index_t *index, const tar_header *header, const char *name,
+                     off_t header_offset, size_t ext_size, int64_t sparse_size) {
+    size_t file_size, mtime, chksum, mode;
+    if (parse_header_size(header, &file_size) != 0 ||
+        parse_octal_field(header->mtime, sizeof(header->mtime), &mtime) != 0 ||
+        parse_octal_field(header->chksum, sizeof(header->chksum), &chksum) != 0 ||
+        parse_octal_field(header->mode, sizeof(header->mode), &mode) != 0) {
+        return -1;
+    }
 
-    // Read The Archive Header.
-    while ((bytes_fetched = fread(&archive_header, sizeof(archive_header), 1, tar_archive)) == 1) {
-        // If The Name of The File is Empty, We Have Reached The End of The Archive.
-        if (archive_header.name[0] == '\0') {
-            break;
-        }
+    index_entry_t entry = {
+        .header_offset = header_offset,
+        .size = file_size,
+        .mtime = mtime,
+        .chksum = chksum,
+        .mode = mode,
+        .typeflag = (unsigned char) header->typeflag,
+        .ext_size = ext_size,
+        .flags = sparse_size >= 0 ? INDEX_SPARSE : 0,
+        .real_size = sparse_size >= 0 ? (uint64_t) sparse_size : file_size,
+    };
+    if (archive_index_add(index, name, &entry) != 0) {
+        perror("Failed to add member to archive index");
+        return -1;
+    }
+    return 0;
+}
 
-        // Add The File Name To The List of Files.
-        if (file_list_add(files, archive_header.name) == -1) {
-            perror("Failed to add file to list");
-            close_file(tar_archive, "Failed to close tar archive");
+// Returns 1 If 'archive_name' Stands For stdin Or stdout Rather Than A File.
+int is_stdio_archive(const char *archive_name) {
+    return strcmp(archive_name, STDIO_ARCHIVE_NAME) == 0;
+}
+
+// Opens The Archive For Reading, Mapping It Into Memory When Possible.
+// 'advice' Is Passed To madvise, e.g. MADV_SEQUENTIAL When Every Body Will Be Read.
+int archive_reader_open(archive_reader_t *reader, const char *archive_name, int advice) {
+    memset(reader, 0, sizeof(archive_reader_t));
+    reader->archive_fd = -1;
+
+    // stdin Is Read Ahead (And Decompressed, If Need Be) On A Thread Of Its Own. It Is Left
+    // Open, As The Reader Does Not Own It.
+    if (is_stdio_archive(archive_name)) {
+        reader->stream = compress_open_pipe(STDIN_FILENO, &reader->compression);
+        if (reader->stream == NULL) {
             return -1;
         }
+        reader->forward_only = 1;
+        return 0;
+    }
 
-        // Convert The Octal String To A Size_t.
-        // This is used to calculate the size of the file.
-        size_t file_size;
-        if (convert_octal_to_size_t(archive_header.size, &file_size) != 0) {
-            close_file(tar_archive, "Failed to close tar archive");
+    int fd = open(archive_name, O_RDONLY);
+    if (fd == -1) {
+        perror("Failed to open tar archive");
+        return -1;
+    }
+
+    compress_type_t compression;
+    if (compress_detect(fd, &compression) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (compression != COMPRESS_NONE) {
+        reader->stream = compress_open_read(fd, compression, 0);
+        if (reader->stream == NULL) {
+            close(fd);
             return -1;
         }
+        reader->forward_only = 1;
+        reader->archive_fd = fd;
+        reader->compression = compression;
+        return 0;
+    }
 
-        // Caluclating the Spacing/Padding needed to move to the next file/block.
-        // If the file size is a multiple of 512, we don't need any padding, else
-        // we need to add padding to reach the next block.
-        size_t spacing;
-        if (file_size % BLOCK_SIZE == 0) {
-            spacing = 0;
-        } else {
-            spacing = BLOCK_SIZE - (file_size % BLOCK_SIZE);
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) == 0 && S_ISREG(stat_buf.st_mode) && stat_buf.st_size > 0) {
+        void *map = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            // The Mapping Stays Valid After The fd Is Closed.
+            madvise(map, stat_buf.st_size, advice);
+            close(fd);
+            reader->map = map;
+            reader->map_size = stat_buf.st_size;
+            return 0;
         }
+    }
 
-        // Move The File Pointer To The Next File.
-        if (fseek(tar_archive, file_size + spacing, SEEK_CUR) != 0) {
-            perror("Failed to seek in tar archive");
-            close_file(tar_archive, "Failed to close tar archive");
+    // Fall Back To stdio If The Archive Cannot Be Mapped.
+    reader->stream = fdopen(fd, "rb");
+    if (reader->stream == NULL) {
+        perror("Failed to open tar archive");
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+// Sets The Current Member's Name To 'prefix', A Slash And 'name', Or Just 'name' If There Is
+// No Prefix. Neither Part Needs To Be Null-Terminated.
+int reader_set_name(archive_reader_t *reader, const char *prefix, size_t prefix_len,
+                    const char *name, size_t name_len) {
+    size_t needed = prefix_len + (prefix_len > 0) + name_len + 1;
+    if (needed > reader->name_capacity) {
+        size_t capacity = reader->name_capacity == 0 ? BLOCK_SIZE : reader->name_capacity;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        char *grown = realloc(reader->name, capacity);
+        if (grown == NULL) {
+            perror("Failed to allocate member name");
             return -1;
         }
+        reader->name = grown;
+        reader->name_capacity = capacity;
     }
 
-    // Close The Tar Archive.
-    if (fclose(tar_archive) != 0) {
-        perror("Failed to close tar archive");
-        return -1;
+    char *dest = reader->name;
+    if (prefix_len > 0) {
+        memcpy(dest, prefix, prefix_len);
+        dest[prefix_len] = '/';
+        dest += prefix_len + 1;
     }
-
+    memcpy(dest, name, name_len);
+    dest[name_len] = '\0';
     return 0;
 }
 
-int extract_files_from_archive(const char *archive_name) {
-    // Opening The Existing Tar Archive With Read Permissions.
-    FILE *tar_archive = fopen(archive_name, "rb");
-    if (tar_archive == NULL) {
-        perror("Failed to open tar archive");
-        return -1;
+// Reads The Contents Of An Extended Header Of 'size' Bytes (And Its Padding), Pointing
+// '*data' At Them. Mapped Archives Are Read In Place.
+int reader_read_ext_data(archive_reader_t *reader, size_t size, const char **data) {
+    size_t spacing = padded_size(size);
+    if (reader->map != NULL) {
+        if (spacing > reader->map_size - reader->offset) {
+            fprintf(stderr, "Failed to read from tar archive: archive is truncated\n");
+            return -1;
+        }
+        *data = reader->map + reader->offset;
+    } else {
+        if (spacing > reader->ext_capacity) {
+            char *grown = realloc(reader->ext_buf, spacing);
+            if (grown == NULL) {
+                perror("Failed to allocate extended header");
+                return -1;
+            }
+            reader->ext_buf = grown;
+            reader->ext_capacity = spacing;
+        }
+        if (fread(reader->ext_buf, 1, spacing, reader->stream) != spacing) {
+            if (ferror(reader->stream) != 0) {
+                perror("Failed to read from tar archive");
+            } else {
+                fprintf(stderr, "Failed to read from tar archive: archive is truncated\n");
+            }
+            return -1;
+        }
+        *data = reader->ext_buf;
     }
+    reader->offset += spacing;
+    return 0;
+}
 
-    tar_header archive_header;
-    size_t bytes_fetched;
+// Looks For The Value Of 'key' Among The "<length> <key>=<value>\n" Records Of A PAX Header.
+// Returns 1 With '*value' Pointing Into 'data' If It Is There, 0 If Not, Or -1 If The Records
+// Are Malformed.
+int pax_find_value(const char *data, size_t size, const char *key, const char **value,
+                   size_t *value_len) {
+    size_t key_len = strlen(key);
+    size_t pos = 0;
+    while (pos < size && data[pos] != '\0') {
+        // Each Record Starts With Its Own Length In Decimal, Which Counts Everything.
+        size_t record_len = 0;
+        size_t i = pos;
+        while (i < size && data[i] >= '0' && data[i] <= '9') {
+            record_len = record_len * 10 + (data[i] - '0');
+            i++;
+        }
+        if (i == pos || i >= size || data[i] != ' ' || record_len > size - pos ||
+            record_len < i - pos + 2 || data[pos + record_len - 1] != '\n') {
+            fprintf(stderr, "Failed to read from tar archive: malformed extended header\n");
+            return -1;
+        }
 
-    while ((bytes_fetched = fread(&archive_header, sizeof(archive_header), 1, tar_archive)) == 1) {
-        // If The Name of The File is Empty, We Have Reached The End of The Archive.
-        if (archive_header.name[0] == '\0') {
-            break;
+        const char *record = data + i + 1;
+        size_t rest_len = pos + record_len - 1 - (i + 1);
+        if (rest_len > key_len && memcmp(record, key, key_len) == 0 && record[key_len] == '=') {
+            *value = record + key_len + 1;
+            *value_len = rest_len - key_len - 1;
+            return 1;
         }
+        pos += record_len;
+    }
+    return 0;
+}
 
-        // Convert The Octal String To A Size_t.
-        // This is used to calculate the size of the file.
-        size_t file_size;
-        if (convert_octal_to_size_t(archive_header.size, &file_size) != 0) {
-            close_file(tar_archive, "Failed to close tar archive");
+// Reads The Decimal Value Of A PAX Record, Such As A "size" Record, Into '*value'.
+int parse_pax_number(const char *text, size_t text_len, uint64_t *value) {
+    *value = 0;
+    for (size_t i = 0; i < text_len; i++) {
+        if (text[i] < '0' || text[i] > '9' || *value > (UINT64_MAX - 9) / 10) {
+            fprintf(stderr, "Failed to read from tar archive: malformed extended header\n");
             return -1;
         }
+        *value = *value * 10 + (text[i] - '0');
+    }
+    return text_len > 0 ? 0 : -1;
+}
 
-        // Open The File To Be Extracted From The Archive.
-        FILE *output_file = fopen(archive_header.name, "wb");
-        if (output_file == NULL) {
-            perror("Failed to open file");
-            close_file(tar_archive, "Failed to close tar archive");
+// Finds The Next Member Header In The Archive.
+// Returns 1 with '*header' pointing at the header, 0 at the end of the archive or -1 on error.
+// Extended Headers In Front Of The Member Are Consumed Along The Way: The Full Name Is Left
+// In reader->name, Their Total Size In reader->ext_size And The Real Size Of A Sparse
+// Member In reader->sparse_size. A Size Given In A PAX Header (Used By Other tar
+// Implementations For Members Of 8 GiB And Up) Is Written Into A Copy Of The Header, So
+// Callers Can Always Read The Size From The Header Itself.
+// The Header Is Only Valid Until The Next Call On The Reader.
+int archive_reader_next_header(archive_reader_t *reader, const tar_header **header) {
+    int have_name = 0;
+    int have_size = 0;
+    uint64_t pax_size = 0;
+    reader->ext_size = 0;
+    reader->sparse_size = -1;
+    while (1) {
+        const tar_header *next_header;
+        if (reader->map != NULL) {
+            // A Mapped Header Is Used In Place, No Copy Needed.
+            if (reader->map_size - reader->offset < sizeof(tar_header)) {
+                return 0;
+            }
+            next_header = (const tar_header *) (reader->map + reader->offset);
+        } else {
+            if (fread(&reader->header_buf, sizeof(tar_header), 1, reader->stream) != 1) {
+                if (ferror(reader->stream) != 0) {
+                    perror("Failed to read from tar archive");
+                    return -1;
+                }
+                return 0;
+            }
+            next_header = &reader->header_buf;
+        }
+        reader->offset += sizeof(tar_header);
+
+        // If The Name of The File is Empty, We Have Reached The End of The Archive.
+        if (next_header->name[0] == '\0') {
+            return 0;
+        }
+        if (minitar_opts.verify_checksums &&
+            verify_header_checksum(next_header, reader->offset - sizeof(tar_header)) != 0) {
             return -1;
         }
 
-        // Read The File Contents From The Archive.
-        char buffer[BLOCK_SIZE] = {0};
-        size_t bytes_remaining = file_size;
+        char typeflag = next_header->typeflag;
+        if (typeflag == PAX_HEADER_TYPE || typeflag == PAX_GLOBAL_TYPE ||
+            typeflag == GNU_LONGNAME_TYPE || typeflag == GNU_LONGLINK_TYPE) {
+            size_t ext_data_size;
+            const char *ext_data;
+            if (parse_header_size(next_header, &ext_data_size) != 0 ||
+                reader_read_ext_data(reader, ext_data_size, &ext_data) != 0) {
+                return -1;
+            }
+            reader->ext_size += sizeof(tar_header) + padded_size(ext_data_size);
+
+            // A Long Name From A PAX Header Wins Over One From A GNU Header.
+            if (typeflag == PAX_HEADER_TYPE) {
+                const char *path;
+                size_t path_len;
+                int found = pax_find_value(ext_data, ext_data_size, "GNU.sparse.name", &path,
+                                           &path_len);
+                if (found == 0) {
+                    found = pax_find_value(ext_data, ext_data_size, "path", &path, &path_len);
+                }
+                if (found == -1 ||
+                    (found && reader_set_name(reader, NULL, 0, path, path_len) != 0)) {
+                    return -1;
+                }
+                have_name |= found;
 
-        // Read The File Contents In Blocks Of 512 Bytes.
-        // If Bytes Fetched is 0, We Have Reached The End Of The File.
-        while (bytes_remaining > 0) {
-            size_t bytes_to_fetch;
-            if (bytes_remaining < BLOCK_SIZE) {
-                bytes_to_fetch = bytes_remaining;
-            } else {
-                bytes_to_fetch = BLOCK_SIZE;
+                // Only Sparse Format 1.0 Is Understood, Where The Map Leads The Contents.
+                const char *sparse_text;
+                size_t sparse_len;
+                found = pax_find_value(ext_data, ext_data_size, "GNU.sparse.major", &sparse_text,
+                                       &sparse_len);
+                if (found == 1 && sparse_len == 1 && sparse_text[0] == '1') {
+                    found = pax_find_value(ext_data, ext_data_size, "GNU.sparse.realsize",
+                                           &sparse_text, &sparse_len);
+                    uint64_t sparse_size;
+                    if (found == 1) {
+                        if (parse_pax_number(sparse_text, sparse_len, &sparse_size) != 0 ||
+                            sparse_size > INT64_MAX) {
+                            return -1;
+                        }
+                        reader->sparse_size = sparse_size;
+                    }
+                }
+                if (found == -1) {
+                    return -1;
+                }
+
+                const char *size_text;
+                size_t size_len;
+                found = pax_find_value(ext_data, ext_data_size, "size", &size_text, &size_len);
+                if (found == -1 ||
+                    (found && parse_pax_number(size_text, size_len, &pax_size) != 0)) {
+                    return -1;
+                }
+                have_size |= found;
+            } else if (typeflag == GNU_LONGNAME_TYPE && !have_name) {
+                if (reader_set_name(reader, NULL, 0, ext_data,
+                                    strnlen(ext_data, ext_data_size)) != 0) {
+                    return -1;
+                }
+                have_name = 1;
             }
+            continue;
+        }
 
-            // Read The File Contents From The Archive/Buffer.
-            size_t bytes_fetched = fread(buffer, 1, bytes_to_fetch, tar_archive);
-            if (bytes_fetched != bytes_to_fetch) {
-                perror("Failed to read from tar archive");
-                close_file(tar_archive, "Failed to close tar archive");
-                close_file(output_file, "Failed to close file");
+        // Otherwise The Name Comes From The Header, Joined To The Prefix Field In ustar
+        // Archives. The Fields Are Not Null-Terminated When Full.
+        if (!have_name) {
+            size_t prefix_len = 0;
+            if (memcmp(next_header->magic, MAGIC, sizeof(next_header->magic)) == 0) {
+                prefix_len = strnlen(next_header->prefix, sizeof(next_header->prefix));
+            }
+            if (reader_set_name(reader, next_header->prefix, prefix_len, next_header->name,
+                                strnlen(next_header->name, sizeof(next_header->name))) != 0) {
                 return -1;
             }
+        }
+        if (have_size) {
+            if (next_header != &reader->header_buf) {
+                reader->header_buf = *next_header;
+                next_header = &reader->header_buf;
+            }
+            encode_numeric(reader->header_buf.size, sizeof(reader->header_buf.size), pax_size);
+        }
 
-            // Write The File Contents To The Output File.
-            // Overwrite The File If It Already Exists.
-            size_t bytes_written = fwrite(buffer, 1, bytes_fetched, output_file);
+        *header = next_header;
+        return 1;
+    }
+}
 
-            // If The Bytes Written Is Not Equal To The Bytes Fetched, Return An Error.
-            if (bytes_written != bytes_fetched) {
-                perror("Failed to write to file");
-                close_file(tar_archive, "Failed to close tar archive");
-                close_file(output_file, "Failed to close file");
+// Reads And Throws Away Up To 'nbytes' Of A Stream That Cannot Seek, Stopping Early At The
+// End Of The Archive. Returns The Number Of Bytes Passed Over, Or -1 On Error.
+ssize_t reader_discard(archive_reader_t *reader, size_t nbytes) {
+    char scratch[BLOCK_SIZE * 16];
+    size_t bytes_discarded = 0;
+    while (bytes_discarded < nbytes) {
+        size_t bytes_to_fetch = nbytes - bytes_discarded;
+        if (bytes_to_fetch > sizeof(scratch)) {
+            bytes_to_fetch = sizeof(scratch);
+        }
+        size_t bytes_fetched = fread(scratch, 1, bytes_to_fetch, reader->stream);
+        bytes_discarded += bytes_fetched;
+        if (bytes_fetched < bytes_to_fetch) {
+            if (ferror(reader->stream) != 0) {
+                perror("Failed to read from tar archive");
                 return -1;
             }
+            break;
+        }
+    }
+    return bytes_discarded;
+}
 
-            // Update The Bytes Remaining.
-            bytes_remaining -= bytes_fetched;
+// Moves The Reader Past A Member Body Of 'file_size' Bytes (And Its Padding).
+int archive_reader_skip(archive_reader_t *reader, size_t file_size) {
+    size_t spacing = padded_size(file_size);
+
+    if (reader->map != NULL) {
+        // Skipping Is Just Pointer Arithmetic, Clamped To The End Of The Mapping.
+        if (spacing > reader->map_size - reader->offset) {
+            spacing = reader->map_size - reader->offset;
+        }
+    } else if (reader->forward_only) {
+        ssize_t bytes_discarded = reader_discard(reader, spacing);
+        if (bytes_discarded < 0) {
+            return -1;
         }
+        spacing = bytes_discarded;
+    } else if (fseeko(reader->stream, spacing, SEEK_CUR) != 0) {
+        perror("Failed to seek in tar archive");
+        return -1;
+    }
 
-        // Handle Padding If The File Size is Not a Multiple of 512,
-        // we need to add padding to reach the next block.
-        if (file_size % BLOCK_SIZE != 0) {
-            size_t padding = BLOCK_SIZE - (file_size % BLOCK_SIZE);
-            if (fseek(tar_archive, padding, SEEK_CUR) != 0) {
-                perror("Failed to seek in tar archive");
-                close_file(tar_archive, "Failed to close tar archive");
-                close_file(output_file, "Failed to close file");
-                return -1;
-            }
+    reader->offset += spacing;
+    return 0;
+}
+
+// Reads The Next 'nbytes' Of The Archive Into 'data', Without Any Regard For Padding.
+int archive_reader_read(archive_reader_t *reader, char *data, size_t nbytes) {
+    if (reader->map != NULL) {
+        if (nbytes > reader->map_size - reader->offset) {
+            fprintf(stderr, "Failed to read from tar archive: archive is truncated\n");
+            return -1;
         }
+        memcpy(data, reader->map + reader->offset, nbytes);
+    } else if (fread(data, 1, nbytes, reader->stream) != nbytes) {
+        if (ferror(reader->stream) != 0) {
+            perror("Failed to read from tar archive");
+        } else {
+            fprintf(stderr, "Failed to read from tar archive: archive is truncated\n");
+        }
+        return -1;
+    }
+    reader->offset += nbytes;
+    return 0;
+}
 
-        // Close The Output File.
-        if (fclose(output_file) != 0) {
-            perror("Failed to close file");
-            close_file(tar_archive, "Failed to close tar archive");
+// Copies A Member Body Of 'file_size' Bytes To 'output_file', Leaving The Reader At The
+// Next Header. Mapped Archives Are Written Straight From The Mapping.
+int archive_reader_copy(archive_reader_t *reader, FILE *output_file, size_t file_size,
+                        copy_buffer_t *buffer) {
+    if (reader->map == NULL) {
+        if (copy_member_contents(reader->stream, output_file, file_size, buffer) != 0) {
             return -1;
         }
+        reader->offset += padded_size(file_size);
+        return 0;
     }
 
-    // Close The Tar Archive.
-    if (fclose(tar_archive) != 0) {
+    if (file_size > reader->map_size - reader->offset) {
+        fprintf(stderr, "Failed to read from tar archive: archive is truncated\n");
+        return -1;
+    }
+    if (fwrite(reader->map + reader->offset, 1, file_size, output_file) != file_size) {
+        perror("Failed to write to file");
+        return -1;
+    }
+    return archive_reader_skip(reader, file_size);
+}
+
+// Starts Decompressing The Archive Again At 'frame', Dropping Whatever The Old Stream Had
+// Yet To Hand Over.
+int reader_restart(archive_reader_t *reader, const index_frame_t *frame) {
+    fclose(reader->stream);
+    reader->stream =
+        compress_open_read(reader->archive_fd, reader->compression, frame->compressed_offset);
+    if (reader->stream == NULL) {
+        return -1;
+    }
+    reader->offset = frame->offset;
+    minitar_stats.frame_jumps++;
+    return 0;
+}
+
+// Lets The Reader Jump Ahead Through A Compressed Archive Using The Frames In 'index', Which
+// Must Outlive It. Does Nothing For An Archive That Is Not Compressed.
+void archive_reader_use_frames(archive_reader_t *reader, const archive_index_t *index) {
+    if (reader->forward_only) {
+        reader->frames = index;
+    }
+}
+
+// Positions The Reader At 'offset' Bytes From The Start Of The Archive.
+int archive_reader_seek(archive_reader_t *reader, size_t offset) {
+    if (reader->map != NULL) {
+        reader->offset = offset < reader->map_size ? offset : reader->map_size;
+        return 0;
+    }
+
+    // A Stream That Cannot Seek Can Still Be Moved Forwards.
+    if (reader->forward_only) {
+        if (offset < reader->offset) {
+            fprintf(stderr, "Failed to seek in tar archive: it can only be read in order\n");
+            return -1;
+        }
+        // Whole Frames In The Way Are Skipped By Decompressing From The Frame Holding
+        // 'offset', So Only That Frame's Data Before 'offset' Is Thrown Away.
+        const index_frame_t *frame = NULL;
+        if (reader->frames != NULL) {
+            frame = archive_index_find_frame(reader->frames, offset);
+        }
+        if (frame != NULL && frame->offset > reader->offset &&
+            reader_restart(reader, frame) != 0) {
+            return -1;
+        }
+        ssize_t bytes_discarded = reader_discard(reader, offset - reader->offset);
+        if (bytes_discarded < 0) {
+            return -1;
+        }
+        reader->offset += bytes_discarded;
+        return 0;
+    }
+    if (fseeko(reader->stream, offset, SEEK_SET) != 0) {
+        perror("Failed to seek in tar archive");
+        return -1;
+    }
+    reader->offset = offset;
+    return 0;
+}
+
+// Releases The Mapping Or Stream Held By The Reader.
+int archive_reader_close(archive_reader_t *reader) {
+    free(reader->name);
+    free(reader->ext_buf);
+    if (reader->map != NULL) {
+        if (munmap((void *) reader->map, reader->map_size) != 0) {
+            perror("Failed to unmap tar archive");
+            return -1;
+        }
+        return 0;
+    }
+
+    int status = 0;
+    if (reader->stream != NULL && fclose(reader->stream) != 0) {
+        perror("Failed to close tar archive");
+        status = -1;
+    }
+    if (reader->archive_fd != -1 && close(reader->archive_fd) != 0) {
         perror("Failed to close tar archive");
+        status = -1;
+    }
+    return status;
+}
+
+// Builds An Index Of Every Member Of An Existing Archive By Walking Its Headers.
+// Members That 'filter' Does Not Pass Are Left Out, Unless It Is NULL, Apart From
+// Directories, Which Files That Pass May Need To Be Extracted Into.
+int build_archive_index(const char *archive_name, archive_index_t *index,
+                        const member_filter_t *filter) {
+    archive_reader_t reader;
+    if (archive_reader_open(&reader, archive_name, MADV_RANDOM) != 0) {
+        return -1;
+    }
+
+    const tar_header *archive_header;
+    int status;
+    while ((status = archive_reader_next_header(&reader, &archive_header)) == 1) {
+        size_t file_size;
+        off_t header_offset = reader.offset - sizeof(tar_header);
+        int wanted = filter == NULL || archive_header->typeflag == DIRTYPE ||
+                     member_filter_match(filter, reader.name);
+        if ((wanted && index_add_header(index, archive_header, reader.name, header_offset,
+                                        reader.ext_size, reader.sparse_size) != 0) ||
+            parse_header_size(archive_header, &file_size) != 0 ||
+            archive_reader_skip(&reader, file_size) != 0) {
+            status = -1;
+            break;
+        }
+    }
+
+    if (archive_reader_close(&reader) != 0 || status == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+// Appends The Record "<length> <key>=<value>\n" To The PAX Header Contents In 'data' At
+// 'pos', Where The Length Counts Its Own Digits Too. Returns The Position After The Record.
+static size_t pax_add_record(char *data, size_t pos, const char *key, const char *value,
+                             size_t value_len) {
+    size_t body_len = strlen(key) + value_len + 3;
+    size_t record_len = body_len + 1;
+    while (record_len != body_len + snprintf(NULL, 0, "%zu", record_len)) {
+        record_len = body_len + snprintf(NULL, 0, "%zu", record_len);
+    }
+
+    int key_len = sprintf(data + pos, "%zu %s=", record_len, key);
+    memcpy(data + pos + key_len, value, value_len);
+    data[pos + record_len - 1] = '\n';
+    return pos + record_len;
+}
+
+// Writes A PAX Extended Header Holding The Full Name 'name' Of The Member Described By
+// 'member_header', Setting '*ext_size' To The Number Of Bytes Written. For A Sparse Member
+// (When 'sparse' Is Not NULL) The Header Holds The GNU Sparse 1.0 Records Instead.
+int write_pax_header(FILE *tar_archive, const tar_header *member_header, const char *name,
+                     size_t name_len, const sparse_map_t *sparse, size_t *ext_size) {
+    char pax_data[PAX_DATA_MAX];
+    size_t record_len;
+    if (sparse != NULL) {
+        char real_size[MAX_OCTAL_FIELD_LEN * 2];
+        int real_size_len = snprintf(real_size, sizeof(real_size), "%llu",
+                                     (unsigned long long) sparse->real_size);
+        record_len = pax_add_record(pax_data, 0, "GNU.sparse.major", "1", 1);
+        record_len = pax_add_record(pax_data, record_len, "GNU.sparse.minor", "0", 1);
+        record_len = pax_add_record(pax_data, record_len, "GNU.sparse.name", name, name_len);
+        record_len = pax_add_record(pax_data, record_len, "GNU.sparse.realsize", real_size,
+                                    real_size_len);
+    } else {
+        record_len = pax_add_record(pax_data, 0, "path", name, name_len);
+    }
+    size_t data_size = padded_size(record_len);
+    memset(pax_data + record_len, 0, data_size - record_len);
+
+    // The Extended Header Borrows The Member's Metadata, Under A Name Of Its Own.
+    tar_header pax_header = *member_header;
+    size_t base_start = name_len - 1;
+    while (base_start > 0 && name[base_start - 1] != '/') {
+        base_start--;
+    }
+    memset(pax_header.name, 0, sizeof(pax_header.name));
+    memset(pax_header.prefix, 0, sizeof(pax_header.prefix));
+    snprintf(pax_header.name, sizeof(pax_header.name), "PaxHeaders/%.*s",
+             (int) (name_len - base_start), name + base_start);
+    pax_header.typeflag = PAX_HEADER_TYPE;
+    encode_octal(pax_header.size, sizeof(pax_header.size), record_len);
+    compute_checksum(&pax_header);
+
+    if (fwrite(&pax_header, sizeof(tar_header), 1, tar_archive) != 1 ||
+        fwrite(pax_data, 1, data_size, tar_archive) != data_size) {
+        perror("Failed to write to tar archive");
+        return -1;
+    }
+    *ext_size = sizeof(tar_header) + data_size;
+    return 0;
+}
+
+// Writes A Member's Header For The File 'file_name' To The Archive, Recording It In 'index'
+// Unless It Is NULL. A Name That Does Not Fit The Header Goes In A PAX Header In Front Of It,
+// As Does The Real Name And Size Of A Sparse Member ('sparse' Holding Any Segments).
+int write_member_header(FILE *tar_archive, const tar_header *archive_header,
+                        const char *file_name, const sparse_map_t *sparse,
+                        archive_index_t *index) {
+    char member_name[MEMBER_NAME_MAX];
+    ssize_t name_len =
+        format_member_name(file_name, archive_header->typeflag == DIRTYPE, member_name);
+    if (name_len < 0) {
         return -1;
     }
+    if (sparse != NULL && sparse->count == 0) {
+        sparse = NULL;
+    }
+
+    // Record Where The Member Starts Before Writing Anything.
+    off_t member_offset = index != NULL ? ftello(tar_archive) : 0;
+    size_t ext_size = 0;
+    if ((sparse != NULL || ustar_prefix_len(member_name, name_len) < 0) &&
+        write_pax_header(tar_archive, archive_header, member_name, name_len, sparse,
+                         &ext_size) != 0) {
+        return -1;
+    }
+    if (index != NULL &&
+        index_add_header(index, archive_header, member_name, member_offset + ext_size, ext_size,
+                         sparse != NULL ? (int64_t) sparse->real_size : -1) != 0) {
+        return -1;
+    }
+
+    // Write The Header To The Archive.
+    // If The Header Is Not Written, Return An Error.
+    size_t write_to_header = fwrite(archive_header, sizeof(tar_header), 1, tar_archive);
+    if (write_to_header != 1) {
+        perror("Failed to write to tar archive");
+        return -1;
+    }
+    if (sparse != NULL) {
+        minitar_stats.sparse_members++;
+        minitar_stats.hole_bytes += sparse->real_size - sparse->data_size;
+    }
+    return 0;
+}
+
+// Copies The Sparse Map And Then Just The Data Segments Of 'input_file' Into The Archive,
+// Then Closes It. The Holes Between The Segments Are Never Read.
+int copy_sparse_into_archive(FILE *tar_archive, FILE *input_file, const sparse_map_t *sparse,
+                             copy_buffer_t *buffer) {
+    size_t map_size = sparse_map_encoded_size(sparse);
+    char *map_data = malloc(map_size);
+    if (map_data == NULL) {
+        perror("Failed to allocate sparse map");
+        close_file(input_file, "Failed to close file");
+        return -1;
+    }
+    sparse_map_encode(sparse, map_data);
+    int status = 0;
+    if (fwrite(map_data, 1, map_size, tar_archive) != map_size) {
+        perror("Failed to write to tar archive");
+        status = -1;
+    }
+    free(map_data);
+
+    // The Header Already Gave The Member's Size, So Exactly The Mapped Data Must Follow.
+    int input_fd = fileno(input_file);
+    for (size_t i = 0; i < sparse->count && status == 0; i++) {
+        off_t offset = sparse->segments[i].offset;
+        uint64_t bytes_remaining = sparse->segments[i].length;
+        while (bytes_remaining > 0) {
+            size_t bytes_to_fetch =
+                bytes_remaining < buffer->size ? bytes_remaining : buffer->size;
+            ssize_t bytes_fetched = pread(input_fd, buffer->data, bytes_to_fetch, offset);
+            if (bytes_fetched <= 0) {
+                if (bytes_fetched == 0) {
+                    fprintf(stderr, "Failed to read file: file shrank while being archived\n");
+                } else {
+                    perror("Failed to read file");
+                }
+                status = -1;
+                break;
+            }
+            if (fwrite(buffer->data, 1, bytes_fetched, tar_archive) != bytes_fetched) {
+                perror("Failed to write to tar archive");
+                status = -1;
+                break;
+            }
+            offset += bytes_fetched;
+            bytes_remaining -= bytes_fetched;
+        }
+    }
+
+    // The Segments Go Out Back To Back, So Only The Last One Leaves A Partial Block.
+    static const char zero_block[BLOCK_SIZE];
+    size_t tail = sparse->data_size % BLOCK_SIZE;
+    if (status == 0 && tail != 0 &&
+        fwrite(zero_block, 1, BLOCK_SIZE - tail, tar_archive) != BLOCK_SIZE - tail) {
+        perror("Failed to write to tar archive");
+        status = -1;
+    }
+
+    if (status != 0) {
+        close_file(input_file, "Failed to close file");
+        return -1;
+    }
+    if (fclose(input_file) != 0) {
+        perror("Failed to close file");
+        return -1;
+    }
+    return 0;
+}
+
+// Copies The Rest Of 'input_file' Into The Archive, Then Closes It.
+// The Kernel-Side Copy Is Tried First When Enabled, Falling Back To Our Buffer.
+int copy_file_into_archive(FILE *tar_archive, FILE *input_file, copy_buffer_t *buffer) {
+    int copy_status = 1;
+    if (minitar_opts.zero_copy) {
+        copy_status = write_file_contents_kernel(tar_archive, input_file);
+    }
+    if (copy_status == 1) {
+        copy_status = write_file_contents(tar_archive, input_file, buffer);
+    }
+    if (copy_status != 0) {
+        close_file(input_file, "Failed to close file");
+        return -1;
+    }
+
+    // Close The Current File.
+    if (fclose(input_file) != 0) {
+        perror("Failed to close file");
+        return -1;
+    }
+    return 0;
+}
+
+// Writes A Header And The Contents Of Each Path The Walk Produces To The Archive, One At A
+// Time.
+int write_archive_members_serial(FILE *tar_archive, tree_walk_t *walk, copy_buffer_t *buffer,
+                                 archive_index_t *index) {
+    member_dir_t dir;
+    member_dir_init(&dir);
+    sparse_map_t sparse;
+    sparse_map_init(&sparse);
+
+    // Iterate Through The Files To Be Added To The Archive.
+    walk_entry_t entry;
+    int walk_status = 0;
+    int status = 0;
+    while (status == 0 && (walk_status = tree_walk_next(walk, &entry)) == 1) {
+        tar_header archive_header;
+
+        // Open The Current File Once, Filling The Header From The Open File.
+        // Handle Errors If The Header Is Not Filled.
+        FILE *input_file;
+        if (open_member(&dir, entry.path, &archive_header, &sparse, &input_file) != 0) {
+            status = -1;
+        } else if (write_member_header(tar_archive, &archive_header, entry.path, &sparse,
+                                       index) != 0) {
+            close_file(input_file, "Failed to close file");
+            status = -1;
+        } else if (archive_header.typeflag == DIRTYPE) {
+            // A Directory Has No Contents Of Its Own.
+            if (fclose(input_file) != 0) {
+                perror("Failed to close file");
+                status = -1;
+            }
+        } else if (sparse.count > 0) {
+            // A File With Holes Only Has Its Data Copied.
+            status = copy_sparse_into_archive(tar_archive, input_file, &sparse, buffer);
+        } else if (copy_file_into_archive(tar_archive, input_file, buffer) != 0) {
+            // Write/Copy The File Contents To The Archive.
+            status = -1;
+        }
+        free(entry.path);
+    }
 
+    sparse_map_clear(&sparse);
+    member_dir_close(&dir);
+    if (status != 0 || walk_status == -1) {
+        return -1;
+    }
     return 0;
 }
+
+// One member being prepared by a worker thread for the writer
+typedef struct {
+    tar_header header;
+    copy_buffer_t data;    // Prefetched start of the member's contents
+    size_t data_len;
+    FILE *input_file;      // Still open if contents remain beyond 'data'
+    sparse_map_t sparse;   // Data segments of the member, if it is a sparse file
+    char *path;            // Path of the member, owned by the slot until it is written
+    size_t member_num;     // Position in the walk of the member held by the slot
+    int state;             // SLOT_EMPTY, SLOT_READY or SLOT_FAILED
+} member_slot_t;
+
+// State shared between the workers and the writer when creating an archive in parallel.
+// Member 'n' is always prepared in slot 'n % num_slots', and a worker may only start on it
+// once the writer has finished with member 'n - num_slots', which bounds memory use.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    member_slot_t *slots;
+    size_t num_slots;
+    tree_walk_t *walk;      // Source of the paths to archive, in archive order
+    size_t num_members;     // Total number of members, once 'walk_ended' is set
+    int walk_ended;         // Set by the first worker to reach the end of the walk
+    int walk_failed;
+    size_t num_written;     // Members the writer has finished with
+    int abort;              // Set by the writer when it gives up
+} create_pipeline_t;
+
+// Opens, Stats And Reads The Start Of One Member Into Its Slot (Worker Side).
+int prepare_member(member_slot_t *slot, member_dir_t *dir, const char *file_name) {
+    if (open_member(dir, file_name, &slot->header, &slot->sparse, &slot->input_file) != 0) {
+        slot->input_file = NULL;
+        return -1;
+    }
+
+    // The Kernel-Side Copy Works From The Start Of The File, And A Sparse File Is Copied By
+    // Segment, So Nothing Is Prefetched For Either.
+    slot->data_len = 0;
+    if ((minitar_opts.zero_copy || slot->sparse.count > 0) && slot->header.typeflag != DIRTYPE) {
+        return 0;
+    }
+    if (slot->header.typeflag == DIRTYPE) {
+        // A Directory Has No Contents Of Its Own.
+        FILE *input_file = slot->input_file;
+        slot->input_file = NULL;
+        if (fclose(input_file) != 0) {
+            perror("Failed to close file");
+            return -1;
+        }
+        return 0;
+    }
+
+    slot->data_len = fread(slot->data.data, 1, slot->data.size, slot->input_file);
+    if (ferror(slot->input_file) != 0) {
+        perror("Failed to read file");
+        close_file(slot->input_file, "Failed to close file");
+        slot->input_file = NULL;
+        return -1;
+    }
+
+    // A Short Read Means The Whole File Fit In The Slot.
+    if (slot->data_len < slot->data.size) {
+        FILE *input_file = slot->input_file;
+        slot->input_file = NULL;
+        if (fclose(input_file) != 0) {
+            perror("Failed to close file");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Worker Thread: Claims Paths In Walk Order And Prepares Each One In Its Slot.
+void *prepare_members(void *arg) {
+    create_pipeline_t *pipeline = arg;
+    member_dir_t dir;
+    member_dir_init(&dir);
+
+    while (1) {
+        // The Walk Hands Out Paths In Order, So Its Sequence Number Is The Member Number.
+        walk_entry_t entry;
+        int walk_status = tree_walk_next(pipeline->walk, &entry);
+        pthread_mutex_lock(&pipeline->lock);
+        if (walk_status != 1) {
+            pipeline->walk_ended = 1;
+            pipeline->walk_failed |= walk_status == -1;
+            pipeline->num_members = entry.seq;
+            pthread_cond_broadcast(&pipeline->changed);
+            break;
+        }
+        size_t member_num = entry.seq;
+        member_slot_t *slot = &pipeline->slots[member_num % pipeline->num_slots];
+
+        // Wait Until The Writer Is Done With The Slot's Previous Member.
+        while (!pipeline->abort && member_num >= pipeline->num_written + pipeline->num_slots) {
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        }
+        if (pipeline->abort) {
+            free(entry.path);
+            break;
+        }
+
+        pthread_mutex_unlock(&pipeline->lock);
+        int status = prepare_member(slot, &dir, entry.path);
+        pthread_mutex_lock(&pipeline->lock);
+        slot->path = entry.path;
+        slot->member_num = member_num;
+        slot->state = status == 0 ? SLOT_READY : SLOT_FAILED;
+        pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    member_dir_close(&dir);
+    return NULL;
+}
+
+// Writes One Prepared Member To The Archive (Writer Side).
+int write_prepared_member(FILE *tar_archive, member_slot_t *slot, copy_buffer_t *buffer,
+                          archive_index_t *index) {
+    if (write_member_header(tar_archive, &slot->header, slot->path, &slot->sparse, index) != 0) {
+        return -1;
+    }
+
+    // Only A File That Fit Entirely In The Slot Can End In A Partial Block.
+    size_t bytes_to_write = slot->data_len;
+    if (bytes_to_write % BLOCK_SIZE != 0) {
+        size_t padding = BLOCK_SIZE - (bytes_to_write % BLOCK_SIZE);
+        memset(slot->data.data + bytes_to_write, 0, padding);
+        bytes_to_write += padding;
+    }
+    if (fwrite(slot->data.data, 1, bytes_to_write, tar_archive) != bytes_to_write) {
+        perror("Failed to write to tar archive");
+        return -1;
+    }
+
+    // Larger Files Are Finished Off By The Writer Itself.
+    if (slot->input_file != NULL) {
+        FILE *input_file = slot->input_file;
+        slot->input_file = NULL;
+        if (slot->sparse.count > 0) {
+            return copy_sparse_into_archive(tar_archive, input_file, &slot->sparse, buffer);
+        }
+        return copy_file_into_archive(tar_archive, input_file, buffer);
+    }
+    return 0;
+}
+
+// Writes Each Path The Walk Produces To The Archive Using 'num_jobs' Worker Threads.
+// Workers Open, Stat And Read Members Concurrently While This Thread Writes Them Out In
+// Walk Order, So The Archive Is Byte-Identical To The One Written Serially.
+int write_archive_members_parallel(FILE *tar_archive, tree_walk_t *walk, copy_buffer_t *buffer,
+                                   archive_index_t *index, int num_jobs) {
+    create_pipeline_t pipeline;
+    memset(&pipeline, 0, sizeof(create_pipeline_t));
+    pipeline.num_slots = num_jobs * SLOTS_PER_JOB;
+    pipeline.walk = walk;
+    pipeline.slots = calloc(pipeline.num_slots, sizeof(member_slot_t));
+    pthread_t *workers = calloc(num_jobs, sizeof(pthread_t));
+    if (pipeline.slots == NULL || workers == NULL) {
+        perror("Failed to allocate worker state");
+        free(pipeline.slots);
+        free(workers);
+        return -1;
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < pipeline.num_slots && status == 0; i++) {
+        status = copy_buffer_init(&pipeline.slots[i].data);
+    }
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.changed, NULL);
+
+    int num_started = 0;
+    while (status == 0 && num_started < num_jobs) {
+        int err = pthread_create(&workers[num_started], NULL, prepare_members, &pipeline);
+        if (err != 0) {
+            errno = err;
+            perror("Failed to start worker thread");
+            status = -1;
+            break;
+        }
+        num_started++;
+    }
+
+    // Write Members Out In Order As Their Slots Become Ready, Until The Walk Runs Out.
+    for (size_t member_num = 0; status == 0; member_num++) {
+        member_slot_t *slot = &pipeline.slots[member_num % pipeline.num_slots];
+
+        pthread_mutex_lock(&pipeline.lock);
+        while ((slot->state == SLOT_EMPTY || slot->member_num != member_num) &&
+               !(pipeline.walk_ended && member_num >= pipeline.num_members)) {
+            pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+        }
+        if (slot->state == SLOT_EMPTY || slot->member_num != member_num) {
+            status = pipeline.walk_failed ? -1 : 0;
+            pthread_mutex_unlock(&pipeline.lock);
+            break;
+        }
+        pthread_mutex_unlock(&pipeline.lock);
+
+        if (slot->state == SLOT_FAILED ||
+            write_prepared_member(tar_archive, slot, buffer, index) != 0) {
+            status = -1;
+        }
+
+        pthread_mutex_lock(&pipeline.lock);
+        free(slot->path);
+        slot->path = NULL;
+        slot->state = SLOT_EMPTY;
+        pipeline.num_written++;
+        pthread_cond_broadcast(&pipeline.changed);
+        pthread_mutex_unlock(&pipeline.lock);
+    }
+
+    // Stop Any Workers Still Running, Then Release Whatever They Left Behind.
+    // Workers Waiting On The Walk Are Woken By Stopping It As Well.
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.abort = 1;
+    pthread_cond_broadcast(&pipeline.changed);
+    pthread_mutex_unlock(&pipeline.lock);
+    tree_walk_stop(walk);
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    for (size_t i = 0; i < pipeline.num_slots; i++) {
+        if (pipeline.slots[i].input_file != NULL) {
+            close_file(pipeline.slots[i].input_file, "Failed to close file");
+        }
+        free(pipeline.slots[i].path);
+        sparse_map_clear(&pipeline.slots[i].sparse);
+        copy_buffer_free(&pipeline.slots[i].data);
+    }
+    pthread_cond_destroy(&pipeline.changed);
+    pthread_mutex_destroy(&pipeline.lock);
+    free(pipeline.slots);
+    free(workers);
+    return status;
+}
+
+// One member moving through the ring with --io-uring, when creating or extracting
+typedef struct {
+    char *path;             // Path of the member being archived, owned by the slot
+    size_t member_num;      // Number of the member being extracted
+    int fd;                 // The member's file, or -1 if it is closed or never opened
+    struct statx stx;       // Metadata of the file being archived
+    size_t data_len;        // Bytes of contents last read into the slot's registered buffer
+    int read_err;           // errno of a failed read, which a directory always gets
+    uint64_t size;          // Size of the member being extracted...
+    off_t data_offset;      // ...where its contents start in the archive...
+    uint64_t read_pos;      // ...and how much of them has been read and written so far
+    uint64_t write_pos;
+    int ops_in_flight;
+    int state;              // SLOT_EMPTY, SLOT_LOADING, SLOT_READY or SLOT_FAILED
+    int err;                // With SLOT_FAILED, the errno of what went wrong (0 if none)...
+    const char *err_msg;    // ...and what was being done
+} ring_slot_t;
+
+static uint64_t ring_tag(size_t slot_num, int op) {
+    return (uint64_t) slot_num << RING_TAG_SHIFT | op;
+}
+
+// Marks A Ring Slot As Failed, Keeping The First Error It Ran Into.
+static void fail_ring_slot(ring_slot_t *slot, int err, const char *err_msg) {
+    if (slot->state != SLOT_FAILED) {
+        slot->state = SLOT_FAILED;
+        slot->err = err;
+        slot->err_msg = err_msg;
+    }
+}
+
+// Reports The Error That Made The Ring Slot For The Member 'name' Fail.
+static void report_ring_slot(const ring_slot_t *slot, const char *name) {
+    if (slot->err == 0) {
+        fprintf(stderr, "%s\n", slot->err_msg);
+        return;
+    }
+    char err_msg[MAX_MSG_LEN];
+    snprintf(err_msg, MAX_MSG_LEN, "%s %s", slot->err_msg, name);
+    errno = slot->err;
+    perror(err_msg);
+}
+
+// Waits For Every Operation Still In Flight Once The Ring Is Given Up On, Keeping Track Of
+// The Files They Open And Close, Then Closes Any Files The Slots Still Have Open.
+void drain_ring(io_ring_t *ring, ring_slot_t *slots) {
+    io_ring_result_t result;
+    while (io_ring_pending(ring) > 0) {
+        if (io_ring_wait(ring) != 0) {
+            perror("Failed to wait for file operations");
+            break;
+        }
+        while (io_ring_next(ring, &result) == 1) {
+            ring_slot_t *slot = &slots[result.tag >> RING_TAG_SHIFT];
+            int op = result.tag & RING_TAG_OP_MASK;
+            if (op == RING_OP_OPEN && result.res >= 0) {
+                slot->fd = result.res;
+            } else if (op == RING_OP_CLOSE) {
+                slot->fd = -1;
+            }
+        }
+    }
+    for (size_t i = 0; i < RING_SLOTS; i++) {
+        if (slots[i].fd != -1) {
+            close(slots[i].fd);
+            slots[i].fd = -1;
+        }
+    }
+}
+
+// Moves A Member Being Archived Through The Ring On To Its Next Step Now That 'result' Is In.
+// Once The File Is Open Its Metadata And The Start Of Its Contents Are Fetched Together,
+// Then It Is Closed Again, Unless The Writer Needs It To Finish Off A Larger File.
+// Returns 0 on success or -1 if the next operation could not be queued
+int advance_create_slot(io_ring_t *ring, ring_slot_t *slots, const io_ring_result_t *result) {
+    size_t slot_num = result->tag >> RING_TAG_SHIFT;
+    ring_slot_t *slot = &slots[slot_num];
+    slot->ops_in_flight--;
+    minitar_stats.ring_operations++;
+    int op = result->tag & RING_TAG_OP_MASK;
+    if (op == RING_OP_OPEN) {
+        if (result->res < 0) {
+            fail_ring_slot(slot, -result->res, "Failed to open file");
+            return 0;
+        }
+        slot->fd = result->res;
+        slot->ops_in_flight += 2;
+        if (io_ring_queue_statx(ring, slot->fd, &slot->stx,
+                                ring_tag(slot_num, RING_OP_STAT)) != 0 ||
+            io_ring_queue_read(ring, slot->fd, slot_num, 0, RING_BUFFER_SIZE, 0,
+                               ring_tag(slot_num, RING_OP_READ)) != 0) {
+            perror("Failed to queue file operation");
+            return -1;
+        }
+        return 0;
+    } else if (op == RING_OP_STAT) {
+        if (result->res < 0) {
+            fail_ring_slot(slot, -result->res, "Failed to stat file");
+        }
+    } else if (op == RING_OP_READ) {
+        if (result->res < 0) {
+            slot->read_err = -result->res;
+        } else {
+            slot->data_len = result->res;
+        }
+    } else if (op == RING_OP_CLOSE) {
+        slot->fd = -1;
+        if (result->res < 0) {
+            fail_ring_slot(slot, -result->res, "Failed to close file");
+        }
+    }
+    if (slot->ops_in_flight > 0) {
+        return 0;
+    }
+    if (slot->fd == -1) {
+        if (slot->state == SLOT_LOADING) {
+            slot->state = SLOT_READY;
+        }
+        return 0;
+    }
+
+    // Both The Metadata And The Start Of The Contents Are In. A Directory Cannot Be Read,
+    // But Has No Contents To Archive Anyway.
+    int is_dir = S_ISDIR(slot->stx.stx_mode);
+    if (slot->read_err != 0 && !is_dir) {
+        fail_ring_slot(slot, slot->read_err, "Failed to read file");
+    }
+
+    // A File That Did Not Fit In The Buffer, Or May Have Holes, Stays Open For The Writer.
+    int maybe_sparse = minitar_opts.sparse && S_ISREG(slot->stx.stx_mode) &&
+                       slot->stx.stx_blocks * BLOCK_SIZE < slot->stx.stx_size;
+    if (slot->state == SLOT_LOADING && !is_dir &&
+        (maybe_sparse || slot->data_len < slot->stx.stx_size)) {
+        slot->state = SLOT_READY;
+        return 0;
+    }
+    slot->ops_in_flight++;
+    if (io_ring_queue_close(ring, slot->fd, ring_tag(slot_num, RING_OP_CLOSE)) != 0) {
+        perror("Failed to queue file operation");
+        return -1;
+    }
+    return 0;
+}
+
+// Writes A Member Loaded Through The Ring To The Archive (Writer Side), Straight From The
+// Slot's Buffer 'data' If It Fit There, Or Else Through Its Still Open File.
+int write_ring_member(FILE *tar_archive, ring_slot_t *slot, char *data, sparse_map_t *sparse,
+                      copy_buffer_t *buffer, archive_index_t *index) {
+    struct stat stat_buf;
+    memset(&stat_buf, 0, sizeof(struct stat));
+    stat_buf.st_mode = slot->stx.stx_mode;
+    stat_buf.st_uid = slot->stx.stx_uid;
+    stat_buf.st_gid = slot->stx.stx_gid;
+    stat_buf.st_size = slot->stx.stx_size;
+    stat_buf.st_blocks = slot->stx.stx_blocks;
+    stat_buf.st_mtime = slot->stx.stx_mtime.tv_sec;
+    stat_buf.st_dev = makedev(slot->stx.stx_dev_major, slot->stx.stx_dev_minor);
+    tar_header header;
+    if (fill_tar_header_from_stat(&header, slot->path, &stat_buf) != 0) {
+        perror("Failed to fill tar header");
+        return -1;
+    }
+
+    sparse->count = 0;
+    if (slot->fd != -1 && minitar_opts.sparse && S_ISREG(stat_buf.st_mode) &&
+        (uint64_t) stat_buf.st_blocks * BLOCK_SIZE < (uint64_t) stat_buf.st_size) {
+        int scan_status = sparse_map_scan(sparse, slot->fd, stat_buf.st_size);
+        if (scan_status == -1) {
+            return -1;
+        }
+        if (scan_status == 1) {
+            fill_sparse_header(&header, slot->path, sparse);
+        }
+    }
+    if (write_member_header(tar_archive, &header, slot->path, sparse, index) != 0) {
+        return -1;
+    }
+    if (header.typeflag == DIRTYPE) {
+        return 0;
+    }
+
+    // The Header Gives The Size From statx, So Only That Much Goes Out Even If The File
+    // Grew Before It Was Read.
+    if (slot->fd == -1) {
+        size_t bytes_to_write = stat_buf.st_size;
+        if (bytes_to_write % BLOCK_SIZE != 0) {
+            size_t padding = BLOCK_SIZE - (bytes_to_write % BLOCK_SIZE);
+            memset(data + bytes_to_write, 0, padding);
+            bytes_to_write += padding;
+        }
+        if (fwrite(data, 1, bytes_to_write, tar_archive) != bytes_to_write) {
+            perror("Failed to write to tar archive");
+            return -1;
+        }
+        return 0;
+    }
+
+    // Anything Else Is Copied Like In The Serial Loop, Reusing The Start Already Read Only
+    // When It Filled The Buffer, So The Rest Follows On From A Block Boundary.
+    FILE *input_file = fdopen(slot->fd, "r");
+    if (input_file == NULL) {
+        perror("Failed to open file");
+        return -1;
+    }
+    slot->fd = -1;
+    if (sparse->count > 0) {
+        return copy_sparse_into_archive(tar_archive, input_file, sparse, buffer);
+    }
+    if (!minitar_opts.zero_copy && slot->data_len == RING_BUFFER_SIZE &&
+        (uint64_t) stat_buf.st_size > RING_BUFFER_SIZE) {
+        if (fwrite(data, 1, RING_BUFFER_SIZE, tar_archive) != RING_BUFFER_SIZE) {
+            perror("Failed to write to tar archive");
+            close_file(input_file, "Failed to close file");
+            return -1;
+        }
+        if (fseeko(input_file, RING_BUFFER_SIZE, SEEK_SET) != 0) {
+            perror("Failed to seek in file");
+            close_file(input_file, "Failed to close file");
+            return -1;
+        }
+    }
+    return copy_file_into_archive(tar_archive, input_file, buffer);
+}
+
+// Writes Each Path The Walk Produces To The Archive, Loading Members Through 'ring'.
+// Up To RING_SLOTS Members Are Opened, Stat'ed, Read And Closed At Once, With The Kernel
+// Working On All Their Operations Together, While This Thread Writes Them Out In Walk
+// Order, So The Archive Is Byte-Identical To The One Written Serially.
+int write_archive_members_ring(FILE *tar_archive, tree_walk_t *walk, copy_buffer_t *buffer,
+                               archive_index_t *index, io_ring_t *ring) {
+    ring_slot_t *slots = calloc(RING_SLOTS, sizeof(ring_slot_t));
+    if (slots == NULL) {
+        perror("Failed to allocate member slots");
+        return -1;
+    }
+    for (size_t i = 0; i < RING_SLOTS; i++) {
+        slots[i].fd = -1;
+    }
+    sparse_map_t sparse;
+    sparse_map_init(&sparse);
+
+    size_t num_started = 0;
+    size_t num_written = 0;
+    int walk_status = 1;
+    int status = 0;
+    while (status == 0) {
+        // Start Loading The Next Paths Of The Walk Into Any Free Slots.
+        while (walk_status == 1 && num_started < num_written + RING_SLOTS) {
+            walk_entry_t entry;
+            walk_status = tree_walk_next(walk, &entry);
+            if (walk_status != 1) {
+                break;
+            }
+            size_t slot_num = num_started % RING_SLOTS;
+            ring_slot_t *slot = &slots[slot_num];
+            memset(slot, 0, sizeof(ring_slot_t));
+            slot->path = entry.path;
+            slot->fd = -1;
+            slot->state = SLOT_LOADING;
+            slot->ops_in_flight = 1;
+            num_started++;
+            if (io_ring_queue_openat(ring, AT_FDCWD, slot->path, O_RDONLY | O_CLOEXEC, 0,
+                                     ring_tag(slot_num, RING_OP_OPEN)) != 0) {
+                perror("Failed to queue file operation");
+                status = -1;
+                break;
+            }
+        }
+
+        // Write Members Out In Order For As Long As The Next One Is Done.
+        while (status == 0 && num_written < num_started) {
+            size_t slot_num = num_written % RING_SLOTS;
+            ring_slot_t *slot = &slots[slot_num];
+            if (slot->state == SLOT_LOADING || slot->ops_in_flight > 0) {
+                break;
+            }
+            if (slot->state == SLOT_FAILED) {
+                report_ring_slot(slot, slot->path);
+                status = -1;
+            } else if (write_ring_member(tar_archive, slot, io_ring_buffer(ring, slot_num),
+                                         &sparse, buffer, index) != 0) {
+                status = -1;
+            }
+            if (slot->fd != -1) {
+                close(slot->fd);
+                slot->fd = -1;
+            }
+            free(slot->path);
+            slot->path = NULL;
+            slot->state = SLOT_EMPTY;
+            num_written++;
+        }
+        if (status != 0 || (walk_status != 1 && num_written == num_started)) {
+            break;
+        }
+
+        // Wait For More Operations To Finish, Moving Each Member On To Its Next Step.
+        if (io_ring_wait(ring) != 0) {
+            perror("Failed to wait for file operations");
+            status = -1;
+            break;
+        }
+        io_ring_result_t result;
+        while (status == 0 && io_ring_next(ring, &result) == 1) {
+            status = advance_create_slot(ring, slots, &result);
+        }
+    }
+
+    // Stop The Walk If Giving Up Early, And Let The Kernel Finish With The Slots.
+    if (status != 0) {
+        tree_walk_stop(walk);
+    }
+    drain_ring(ring, slots);
+    for (size_t i = 0; i < RING_SLOTS; i++) {
+        free(slots[i].path);
+    }
+    free(slots);
+    sparse_map_clear(&sparse);
+    if (status != 0 || walk_status == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+// Sets Up The Ring Used With --io-uring.
+// Returns 0 With '*ring' Set, 1 If --io-uring Was Not Given Or io_uring Is Unavailable,
+// So The Usual System Calls Are Used Instead, Or -1 On Error.
+int open_io_ring(io_ring_t **ring) {
+    if (!minitar_opts.io_uring) {
+        return 1;
+    }
+    return io_ring_open(ring, RING_DEPTH, RING_SLOTS, RING_BUFFER_SIZE);
+}
+
+// Writes A Header And The Contents Of Each File In 'files' To The Archive, Descending Into
+// Any Directories Among Them.
+// Each Member Is Also Recorded In 'index', Unless It Is NULL.
+// Shared By create_archive And append_files_to_archive.
+int write_archive_members(FILE *tar_archive, const file_list_t *files, copy_buffer_t *buffer,
+                          archive_index_t *index) {
+    io_ring_t *ring;
+    int ring_status = open_io_ring(&ring);
+    if (ring_status == -1) {
+        return -1;
+    }
+
+    // The Tree Is Walked On Its Own Thread While Members Are Written.
+    tree_walk_t walk;
+    if (tree_walk_start(&walk, files, &minitar_opts.filter) != 0) {
+        if (ring_status == 0) {
+            io_ring_free(ring);
+        }
+        return -1;
+    }
+
+    int status;
+    if (ring_status == 0) {
+        status = write_archive_members_ring(tar_archive, &walk, buffer, index, ring);
+        io_ring_free(ring);
+    } else if (minitar_opts.num_jobs > 1) {
+        status = write_archive_members_parallel(tar_archive, &walk, buffer, index,
+                                                minitar_opts.num_jobs);
+    } else {
+        status = write_archive_members_serial(tar_archive, &walk, buffer, index);
+    }
+    if (tree_walk_finish(&walk) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+// Works Out How An Existing Archive Is Compressed From Its First Bytes.
+int archive_compression(const char *archive_name, compress_type_t *compression) {
+    int archive_fd = open(archive_name, O_RDONLY);
+    if (archive_fd == -1) {
+        perror("Failed to open tar archive");
+        return -1;
+    }
+    int status = compress_detect(archive_fd, compression);
+    close(archive_fd);
+    return status;
+}
+
+// Creates A New, Empty Archive, Going Through The Compression Stage If One Was Asked For.
+// The Compressed Frames Written Are Recorded In 'frames', Unless It Is NULL.
+// An Archive Written To stdout Goes Through A Copy Of Its fd, So Closing The Archive Leaves
+// stdout Itself Open.
+FILE *open_new_archive(const char *archive_name, compress_frame_table_t *frames) {
+    int archive_fd;
+    if (is_stdio_archive(archive_name)) {
+        archive_fd = dup(STDOUT_FILENO);
+    } else {
+        archive_fd = open(archive_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if (archive_fd == -1) {
+        perror("Failed to create tar archive");
+        return NULL;
+    }
+
+    if (minitar_opts.compression == COMPRESS_NONE) {
+        FILE *tar_archive = fdopen(archive_fd, "wb");
+        if (tar_archive == NULL) {
+            perror("Failed to create tar archive");
+            close(archive_fd);
+        }
+        return tar_archive;
+    }
+
+    FILE *tar_archive = compress_open_write(archive_fd, minitar_opts.compression,
+                                            minitar_opts.num_jobs, 0, frames);
+    if (tar_archive == NULL) {
+        close(archive_fd);
+    }
+    return tar_archive;
+}
+
+// Writes The Footer That Ends The Archive. The Compression Stage Writes A Compressed
+// Archive's Footer Itself, In A Frame Of Its Own, When The Archive Is Closed.
+int finish_archive(FILE *tar_archive, compress_type_t compression) {
+    if (compression != COMPRESS_NONE) {
+        return 0;
+    }
+    return write_footer(tar_archive);
+}
+
+// Adds The Frames Of A Compressed Archive To The End Of 'index', Then Saves It.
+int save_archive_index(archive_index_t *index, const compress_frame_table_t *frames,
+                       const char *archive_name) {
+    for (size_t i = 0; i < frames->count; i++) {
+        if (archive_index_add_frame(index, frames->frames[i].compressed_offset,
+                                    frames->frames[i].offset) != 0) {
+            perror("Failed to add frame to archive index");
+            return -1;
+        }
+    }
+    return archive_index_save(index, archive_name);
+}
+
+int create_archive(const char *archive_name, const file_list_t *files) {
+    copy_buffer_t buffer;
+    if (copy_buffer_init(&buffer) != 0) {
+        return -1;
+    }
+
+    // Index The New Members If Requested, Otherwise Drop Any Index Of A Previous Archive.
+    // The Index Also Records Where Each Compressed Frame Starts.
+    archive_index_t index;
+    archive_index_init(&index);
+    archive_index_t *new_index = minitar_opts.write_index ? &index : NULL;
+    if (new_index == NULL && !is_stdio_archive(archive_name)) {
+        archive_index_remove(archive_name);
+    }
+    compress_frame_table_t frames;
+    compress_frame_table_init(&frames);
+
+    // Create A New Tar Archive with Write Binary Permissions.
+    FILE *tar_archive = open_new_archive(archive_name, new_index != NULL ? &frames : NULL);
+    if (tar_archive == NULL) {
+        copy_buffer_free(&buffer);
+        return -1;
+    }
+
+    // Write Each File, Then The Footer (Using The Padding Helper)
+    if (write_archive_members(tar_archive, files, &buffer, new_index) != 0 ||
+        finish_archive(tar_archive, minitar_opts.compression) != 0) {
+        close_file(tar_archive, "Failed to close tar archive");
+        copy_buffer_free(&buffer);
+        archive_index_clear(&index);
+        compress_frame_table_clear(&frames);
+        return -1;
+    }
+    copy_buffer_free(&buffer);
+
+    // Close The Tar Archive.
+    if (fclose(tar_archive) != 0) {
+        perror("Failed to close tar archive");
+        archive_index_clear(&index);
+        compress_frame_table_clear(&frames);
+        return -1;
+    }
+
+    // The Index Is Stamped With The Finished Archive, So It Is Saved Last.
+    int status = 0;
+    if (new_index != NULL) {
+        status = save_archive_index(new_index, &frames, archive_name);
+    }
+    archive_index_clear(&index);
+    compress_frame_table_clear(&frames);
+    return status;
+}
+
+// Opens An Existing Archive And Removes Its Footer, Leaving The Stream At The End Of Its Last
+// Member, Ready For More. A Compressed Archive Is Appended To With More Compressed Frames,
+// Their Position Taken From 'index' (Which Then Lists Every Member) Unless That Is NULL,
+// And Recorded In 'frames'.
+FILE *open_archive_for_append(const char *archive_name, const archive_index_t *index,
+                              compress_type_t *compression, compress_frame_table_t *frames) {
+    // Opening The Existing Tar Archive With Read/Write Permissions.
+    // Note: O_RDWR Without O_CREAT Fails If The File Does Not Exist.
+    int archive_fd = open(archive_name, O_RDWR);
+    if (archive_fd == -1) {
+        perror("Failed to open tar archive");
+        return NULL;
+    }
+    if (compress_detect(archive_fd, compression) != 0) {
+        close(archive_fd);
+        return NULL;
+    }
+    if (minitar_opts.compression != COMPRESS_NONE && minitar_opts.compression != *compression) {
+        fprintf(stderr, "Failed to append to tar archive: archive is compressed differently\n");
+        close(archive_fd);
+        return NULL;
+    }
+
+    if (*compression == COMPRESS_NONE) {
+        FILE *tar_archive = fdopen(archive_fd, "r+b");
+        if (tar_archive == NULL) {
+            perror("Failed to open tar archive");
+            close(archive_fd);
+            return NULL;
+        }
+
+        // Removing The Trailing Bytes / Footer From The Archive.
+        if (remove_trailing_bytes(archive_name, BLOCK_SIZE * NUM_TRAILING_BLOCKS) != 0) {
+            perror("Failed to remove trailing bytes from archive");
+            close_file(tar_archive, "Failed to close tar archive");
+            return NULL;
+        }
+
+        // Move The File Pointer To The End Of The Archive.
+        if (fseek(tar_archive, 0, SEEK_END) != 0) {
+            perror("Failed to move file pointer to the end of the archive");
+            close_file(tar_archive, "Failed to close tar archive");
+            return NULL;
+        }
+        return tar_archive;
+    }
+
+    // The Footer Frame Comes Off Whole, So The New Frame Follows The Last Member's Data.
+    int footer_status = compress_remove_footer(archive_fd, *compression);
+    if (footer_status == 1) {
+        fprintf(stderr, "Failed to append to tar archive: compressed archive does not end "
+                        "in a separate footer frame\n");
+    }
+    if (footer_status != 0) {
+        close(archive_fd);
+        return NULL;
+    }
+    if (lseek(archive_fd, 0, SEEK_END) == -1) {
+        perror("Failed to move file pointer to the end of the archive");
+        close(archive_fd);
+        return NULL;
+    }
+
+    off_t end_offset = 0;
+    if (index != NULL && index->count > 0) {
+        const index_entry_t *last = &index->entries[index->count - 1];
+        end_offset = last->header_offset + sizeof(tar_header) + padded_size(last->size);
+    }
+    FILE *tar_archive =
+        compress_open_write(archive_fd, *compression, minitar_opts.num_jobs, end_offset, frames);
+    if (tar_archive == NULL) {
+        close(archive_fd);
+    }
+    return tar_archive;
+}
+
+int append_files_to_archive(const char *archive_name, const file_list_t *files) {
+    // An Existing, Up To Date Index Is Always Kept Up To Date.
+    // With --index, One Is Built From The Current Headers If Needed.
+    archive_index_t index;
+    int index_status = archive_index_load(&index, archive_name);
+    if (index_status == -1) {
+        return -1;
+    } else if (index_status == 1 && minitar_opts.write_index) {
+        if (build_archive_index(archive_name, &index, NULL) != 0) {
+            archive_index_clear(&index);
+            return -1;
+        }
+        index_status = 0;
+    } else if (index_status == 1) {
+        archive_index_remove(archive_name);
+    }
+    archive_index_t *new_index = index_status == 0 ? &index : NULL;
+
+    copy_buffer_t buffer;
+    if (copy_buffer_init(&buffer) != 0) {
+        archive_index_clear(&index);
+        return -1;
+    }
+
+    compress_type_t compression;
+    compress_frame_table_t frames;
+    compress_frame_table_init(&frames);
+    FILE *tar_archive = open_archive_for_append(archive_name, new_index, &compression,
+                                                new_index != NULL ? &frames : NULL);
+    if (tar_archive == NULL) {
+        copy_buffer_free(&buffer);
+        archive_index_clear(&index);
+        return -1;
+    }
+
+    // Write Each New File, Then The Footer
+    if (write_archive_members(tar_archive, files, &buffer, new_index) != 0 ||
+        finish_archive(tar_archive, compression) != 0) {
+        close_file(tar_archive, "Failed to close tar archive");
+        copy_buffer_free(&buffer);
+        archive_index_clear(&index);
+        compress_frame_table_clear(&frames);
+        return -1;
+    }
+    copy_buffer_free(&buffer);
+
+    // Close The Tar Archive.
+    if (fclose(tar_archive) != 0) {
+        perror("Failed to close tar archive");
+        archive_index_clear(&index);
+        compress_frame_table_clear(&frames);
+        return -1;
+    }
+
+    int status = 0;
+    if (new_index != NULL) {
+        status = save_archive_index(new_index, &frames, archive_name);
+    }
+    archive_index_clear(&index);
+    compress_frame_table_clear(&frames);
+    return status;
+}
+
+// Run Of Positions In An Index's Name Order, 'first' Up To (Not Including) 'end'
+typedef struct {
+    size_t first;
+    size_t end;
+} name_range_t;
+
+static int compare_name_ranges(const void *a, const void *b) {
+    const name_range_t *range_a = a;
+    const name_range_t *range_b = b;
+    return range_a->first < range_b->first ? -1 : range_a->first > range_b->first;
+}
+
+static int compare_member_numbers(const void *a, const void *b) {
+    uint32_t member_a = *(const uint32_t *) a;
+    uint32_t member_b = *(const uint32_t *) b;
+    return member_a < member_b ? -1 : member_a > member_b;
+}
+
+// Finds Where The Members Starting With Each Literal Prefix Of 'filter' Lie In The Name
+// Order Of 'index' (See member_filter_has_prefixes), With Overlapping Ranges Merged.
+// Sets '*ranges_out' To A malloc'd Array In Name Order And Returns Its Length, Or -1 On Error.
+ssize_t find_prefix_ranges(const archive_index_t *index, const member_filter_t *filter,
+                           name_range_t **ranges_out) {
+    name_range_t *ranges = malloc(filter->num_includes * sizeof(name_range_t));
+    if (ranges == NULL) {
+        perror("Failed to allocate member ranges");
+        return -1;
+    }
+    for (size_t i = 0; i < filter->num_includes; i++) {
+        archive_index_prefix_range(index, filter->includes[i],
+                                   member_filter_prefix_len(filter, i), &ranges[i].first,
+                                   &ranges[i].end);
+    }
+    qsort(ranges, filter->num_includes, sizeof(name_range_t), compare_name_ranges);
+
+    // One Prefix May Start With Another ("logs/" and "logs/2026-"), So Ranges Can Overlap.
+    size_t num_ranges = 0;
+    for (size_t i = 0; i < filter->num_includes; i++) {
+        if (ranges[i].first == ranges[i].end) {
+            continue;
+        }
+        if (num_ranges > 0 && ranges[i].first <= ranges[num_ranges - 1].end) {
+            if (ranges[i].end > ranges[num_ranges - 1].end) {
+                ranges[num_ranges - 1].end = ranges[i].end;
+            }
+        } else {
+            ranges[num_ranges++] = ranges[i];
+        }
+    }
+    *ranges_out = ranges;
+    return num_ranges;
+}
+
+// Adds The Names Of The Members Of 'index' That 'filter' Passes To 'files', In Archive
+// Order. When Every Include Pattern Starts With Literal Text, Only Members Whose Names
+// Start The Same Way Are Looked At, Found Through The Index's Name Order.
+int list_indexed_members(const archive_index_t *index, const member_filter_t *filter,
+                         file_list_t *files) {
+    if (!member_filter_has_prefixes(filter) || index->sorted == NULL) {
+        if (!member_filter_active(filter) &&
+            file_list_reserve(files, index->count, index->names_size) != 0) {
+            perror("Failed to add file to list");
+            return -1;
+        }
+        for (size_t i = 0; i < index->count; i++) {
+            const char *name = archive_index_name(index, i);
+            if (member_filter_match(filter, name) && file_list_add(files, name) != 0) {
+                perror("Failed to add file to list");
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    name_range_t *ranges;
+    ssize_t num_ranges = find_prefix_ranges(index, filter, &ranges);
+    if (num_ranges < 0) {
+        return -1;
+    }
+    size_t num_candidates = 0;
+    for (ssize_t i = 0; i < num_ranges; i++) {
+        num_candidates += ranges[i].end - ranges[i].first;
+    }
+    // No Name Starts With Any Of The Prefixes, So Nothing Can Match.
+    if (num_candidates == 0) {
+        free(ranges);
+        return 0;
+    }
+    uint32_t *candidates = malloc(num_candidates * sizeof(uint32_t));
+    if (candidates == NULL) {
+        perror("Failed to allocate member list");
+        free(ranges);
+        return -1;
+    }
+    num_candidates = 0;
+    for (ssize_t i = 0; i < num_ranges; i++) {
+        for (size_t pos = ranges[i].first; pos < ranges[i].end; pos++) {
+            candidates[num_candidates++] = index->sorted[pos];
+        }
+    }
+    free(ranges);
+
+    // Back Into Archive Order, Where The Full Patterns Are Finally Matched.
+    qsort(candidates, num_candidates, sizeof(uint32_t), compare_member_numbers);
+    int status = 0;
+    for (size_t i = 0; i < num_candidates && status == 0; i++) {
+        const char *name = archive_index_name(index, candidates[i]);
+        if (member_filter_match(filter, name) && file_list_add(files, name) != 0) {
+            perror("Failed to add file to list");
+            status = -1;
+        }
+    }
+    free(candidates);
+    return status;
+}
+
+int get_archive_file_list(const char *archive_name, file_list_t *files) {
+    // An Up To Date Index Already Holds Every Name, In Archive Order.
+    // Checksums Can Only Be Verified By Walking The Headers, So The Index Is Not Used Then.
+    // An Archive On stdin Has No Index.
+    archive_index_t index;
+    int index_status = minitar_opts.verify_checksums || is_stdio_archive(archive_name)
+                           ? 1
+                           : archive_index_load(&index, archive_name);
+    if (index_status == -1) {
+        return -1;
+    } else if (index_status == 0) {
+        int status = list_indexed_members(&index, &minitar_opts.filter, files);
+        archive_index_clear(&index);
+        return status;
+    }
+
+    // Opening The Existing Tar Archive For Reading.
+    // Only Headers Are Touched, So Read-Ahead Of The Bodies Would Be Wasted.
+    archive_reader_t reader;
+    if (archive_reader_open(&reader, archive_name, MADV_RANDOM) != 0) {
+        return -1;
+    }
+
+    const tar_header *archive_header;
+    int status;
+
+    // Read The Archive Header.
+    while ((status = archive_reader_next_header(&reader, &archive_header)) == 1) {
+        // Add The File Name To The List of Files, If The Filter Passes It.
+        // The Reader Has Already Put Together The Full Name From Any Prefix Or Long Name.
+        if (member_filter_match(&minitar_opts.filter, reader.name) &&
+            file_list_add(files, reader.name) != 0) {
+            perror("Failed to add file to list");
+            archive_reader_close(&reader);
+            return -1;
+        }
+
+        // Convert The Octal String To A Size_t.
+        // This is used to calculate the size of the file.
+        size_t file_size;
+        if (parse_header_size(archive_header, &file_size) != 0) {
+            archive_reader_close(&reader);
+            return -1;
+        }
+
+        // Move To The Next File (Skipping The Body And Its Padding).
+        if (archive_reader_skip(&reader, file_size) != 0) {
+            archive_reader_close(&reader);
+            return -1;
+        }
+    }
+
+    // Close The Tar Archive.
+    if (archive_reader_close(&reader) != 0 || status == -1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Extracts One Member Whose Body Starts At The Reader's Current Position, Leaving The
+// Reader At The Next Header.
+int extract_member(archive_reader_t *reader, const char *name, size_t file_size,
+                   copy_buffer_t *buffer) {
+    // Open The File To Be Extracted From The Archive.
+    // Overwrite The File If It Already Exists.
+    FILE *output_file = fopen(name, "wb");
+    if (output_file == NULL) {
+        perror("Failed to open file");
+        return -1;
+    }
+
+    // Copy The File Contents (Skipping Its Padding) From The Archive.
+    if (archive_reader_copy(reader, output_file, file_size, buffer) != 0) {
+        close_file(output_file, "Failed to close file");
+        return -1;
+    }
+
+    // Close The Output File.
+    if (fclose(output_file) != 0) {
+        perror("Failed to close file");
+        return -1;
+    }
+    return 0;
+}
+
+// Creates The Directory Member 'name', Which Is Fine If It Already Exists.
+int extract_directory(const char *name) {
+    if (mkdir(name, 0777) != 0 && errno != EEXIST) {
+        char err_msg[MAX_MSG_LEN];
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to create directory %s", name);
+        perror(err_msg);
+        return -1;
+    }
+    return 0;
+}
+
+// Marks Which Members Of 'members' Hold The Most Recent Version Of Their Name.
+// Walks Backwards, So The First Time A Name Is Seen It Is The Last Occurrence.
+// Sets live[i] For Each Such Member And Returns How Many There Are, Or -1 On Error.
+// The Superseded Versions Are Counted In minitar_stats.
+long find_live_members(const archive_index_t *members, char *live) {
+    file_list_t seen;
+    file_list_init(&seen);
+    long num_live = 0;
+    for (size_t i = members->count; i-- > 0;) {
+        const char *name = archive_index_name(members, i);
+        live[i] = !file_list_contains(&seen, name);
+        if (live[i]) {
+            if (file_list_add(&seen, name) != 0) {
+                perror("Failed to add file to list");
+                file_list_clear(&seen);
+                return -1;
+            }
+            num_live++;
+        } else {
+            minitar_stats.superseded_members++;
+            minitar_stats.superseded_bytes += members->entries[i].size;
+        }
+    }
+    file_list_clear(&seen);
+    return num_live;
+}
+
+// Finds The Name In 'wanted' (Which Holds Names Without Trailing Slashes) That Asks For The
+// Member 'name': The Member's Own Name, Or The Name Of A Directory It Lies Beneath. Any Name
+// That Does Is Added To 'found'.
+// Returns 1 If The Member Was Asked For, 0 If Not, Or -1 On Error.
+int member_wanted(const file_list_t *wanted, file_list_t *found, const char *name) {
+    char *path = strdup(name);
+    if (path == NULL) {
+        perror("Failed to allocate member name");
+        return -1;
+    }
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        path[--len] = '\0';
+    }
+
+    // Each Lookup Is A Hash Probe, Once For The Name And Once Per Directory Above It.
+    int status = 0;
+    while (1) {
+        if (file_list_contains(wanted, path)) {
+            status = 1;
+            break;
+        }
+        char *slash = strrchr(path, '/');
+        if (slash == NULL || slash == path) {
+            break;
+        }
+        *slash = '\0';
+    }
+    if (status == 1 && !file_list_contains(found, path) && file_list_add(found, path) != 0) {
+        perror("Failed to add file to list");
+        status = -1;
+    }
+    free(path);
+    return status;
+}
+
+// Adds Each Name In 'names' To 'wanted' Without Its Trailing Slashes, As member_wanted
+// Expects, Since A Directory May Be Asked For With Or Without One.
+int make_wanted_names(const file_list_t *names, file_list_t *wanted) {
+    for (node_t *curr_name = names->head; curr_name != NULL; curr_name = curr_name->next) {
+        char *name = strdup(curr_name->name);
+        if (name == NULL) {
+            perror("Failed to allocate member name");
+            return -1;
+        }
+        size_t len = strlen(name);
+        while (len > 1 && name[len - 1] == '/') {
+            name[--len] = '\0';
+        }
+        int status = file_list_add(wanted, name);
+        free(name);
+        if (status != 0) {
+            perror("Failed to add file to list");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Fails With ENOENT If Any Name In 'wanted' Is Missing From 'found', Reporting The First.
+int check_names_found(const file_list_t *wanted, const file_list_t *found) {
+    for (node_t *curr_name = wanted->head; curr_name != NULL; curr_name = curr_name->next) {
+        if (!file_list_contains(found, curr_name->name)) {
+            fprintf(stderr, "Failed to extract %s: not found in archive\n", curr_name->name);
+            errno = ENOENT;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Adds Every Directory Above The Member 'name' To 'dirs', Each With Its Trailing Slash As It
+// Would Be Named In The Archive.
+int add_parent_directories(file_list_t *dirs, const char *name) {
+    char *path = strdup(name);
+    if (path == NULL) {
+        perror("Failed to allocate member name");
+        return -1;
+    }
+    for (char *slash = strchr(path, '/'); slash != NULL && slash[1] != '\0';
+         slash = strchr(slash + 1, '/')) {
+        char next = slash[1];
+        slash[1] = '\0';
+        if (!file_list_contains(dirs, path) && file_list_add(dirs, path) != 0) {
+            perror("Failed to add file to list");
+            free(path);
+            return -1;
+        }
+        slash[1] = next;
+    }
+    free(path);
+    return 0;
+}
+
+// Marks The Last Version Of Each Member That 'filter' Passes In 'live', Plus The Directory
+// Members Above Them, Like find_wanted_members Without Any Names. Only The Members Starting
+// With One Of The Filter's Literal Prefixes Are Looked At, Through The Name Order Of
+// 'members', Where The Versions Of Each Name Sit Together With The Last One At The End.
+// Returns How Many Members Are Marked, Or -1 On Error.
+long find_prefixed_members(const archive_index_t *members, const member_filter_t *filter,
+                           char *live) {
+    memset(live, 0, members->count);
+    name_range_t *ranges;
+    ssize_t num_ranges = find_prefix_ranges(members, filter, &ranges);
+    if (num_ranges < 0) {
+        return -1;
+    }
+
+    file_list_t parents;
+    file_list_init(&parents);
+    long num_live = 0;
+    int status = 0;
+    for (ssize_t i = 0; i < num_ranges && status == 0; i++) {
+        for (size_t pos = ranges[i].first; pos < ranges[i].end && status == 0; pos++) {
+            uint32_t member = members->sorted[pos];
+            const char *name = archive_index_name(members, member);
+            if (pos + 1 < ranges[i].end &&
+                strcmp(name, archive_index_name(members, members->sorted[pos + 1])) == 0) {
+                minitar_stats.superseded_members++;
+                minitar_stats.superseded_bytes += members->entries[member].size;
+            } else if (member_filter_match(filter, name)) {
+                live[member] = 1;
+                num_live++;
+                status = add_parent_directories(&parents, name);
+            }
+        }
+    }
+    free(ranges);
+
+    // Each Directory Above A Marked Member Is Looked Up By Name, Rather Than Scanning.
+    for (node_t *parent = parents.head; status == 0 && parent != NULL; parent = parent->next) {
+        long member = archive_index_find_newest(members, parent->name);
+        if (member >= 0 && !live[member] && members->entries[member].typeflag == DIRTYPE) {
+            live[member] = 1;
+            num_live++;
+        }
+    }
+    file_list_clear(&parents);
+    return status == 0 ? num_live : -1;
+}
+
+// Marks The Members Of 'members' To Extract In 'live': The Last Version Of Each Member, Or
+// When 'names' Is Not Empty, Only Of Those It Asks For, And Only Those 'filter' Passes (Plus
+// The Directory Members Above Them, So They Have Somewhere To Go). Fails If Any Name In
+// 'names' Matches No Member.
+// Returns How Many Members Are Marked, Or -1 On Error.
+long find_wanted_members(const archive_index_t *members, const file_list_t *names,
+                         const member_filter_t *filter, char *live) {
+    if (names->size == 0 && member_filter_has_prefixes(filter) && members->sorted != NULL) {
+        return find_prefixed_members(members, filter, live);
+    }
+    long num_live = find_live_members(members, live);
+    if (num_live < 0 || (names->size == 0 && !member_filter_active(filter))) {
+        return num_live;
+    }
+
+    file_list_t wanted, found, parents;
+    file_list_init(&wanted);
+    file_list_init(&found);
+    file_list_init(&parents);
+    int status = make_wanted_names(names, &wanted);
+
+    // Directories That Were Not Asked For Are Held Back Until Every Member Wanted Beneath
+    // Them Is Known.
+    const char held_back = 2;
+    for (size_t i = 0; status == 0 && i < members->count; i++) {
+        if (!live[i]) {
+            continue;
+        }
+        const char *name = archive_index_name(members, i);
+        int result = names->size == 0 ? 1 : member_wanted(&wanted, &found, name);
+        if (result == 1 && !member_filter_match(filter, name)) {
+            result = 0;
+        }
+        if (result == 1 && add_parent_directories(&parents, name) != 0) {
+            result = -1;
+        }
+        if (result == 1) {
+            live[i] = 1;
+        } else if (result == 0 && members->entries[i].typeflag == DIRTYPE) {
+            live[i] = held_back;
+        } else {
+            live[i] = 0;
+            status = result;
+        }
+    }
+    num_live = 0;
+    for (size_t i = 0; status == 0 && i < members->count; i++) {
+        if (live[i] == held_back) {
+            live[i] = file_list_contains(&parents, archive_index_name(members, i));
+        }
+        num_live += live[i];
+    }
+
+    if (status == 0) {
+        status = check_names_found(&wanted, &found);
+    }
+    file_list_clear(&wanted);
+    file_list_clear(&found);
+    file_list_clear(&parents);
+    return status == 0 ? num_live : -1;
+}
+
+// Gets The Member Table Of An Archive, From Its Index When That Is Current, Otherwise By
+// Walking Its Headers. Sets '*indexed' To Say Which, Unless It Is NULL.
+// A Walk Leaves Out The Files 'filter' Does Not Pass (See build_archive_index); An Index Is
+// Loaded Whole, As It Costs No More To Read.
+int load_archive_members(const char *archive_name, archive_index_t *members, int *indexed,
+                         const member_filter_t *filter) {
+    int index_status = archive_index_load(members, archive_name);
+    if (indexed != NULL) {
+        *indexed = index_status == 0;
+    }
+    // Checksums Can Only Be Verified By Walking The Headers, So The Index Is Not Used Then.
+    if (index_status == 0 && minitar_opts.verify_checksums) {
+        archive_index_clear(members);
+        index_status = 1;
+    }
+    if (index_status == 1) {
+        index_status = build_archive_index(archive_name, members, filter);
+    }
+    if (index_status != 0) {
+        archive_index_clear(members);
+        return -1;
+    }
+    return 0;
+}
+
+// Writes All 'nbytes' Of 'data' To 'fd', Retrying Short Writes.
+int write_all(int fd, const char *data, size_t nbytes) {
+    while (nbytes > 0) {
+        ssize_t bytes_written = write(fd, data, nbytes);
+        if (bytes_written < 0) {
+            return -1;
+        }
+        data += bytes_written;
+        nbytes -= bytes_written;
+    }
+    return 0;
+}
+
+// Extracts One Member By Reading Its Body With pread, So Any Number Of Threads Can Share
+// The Same Archive fd.
+int extract_member_pread(int archive_fd, const char *name, off_t data_offset, size_t file_size,
+                         copy_buffer_t *buffer) {
+    // Overwrite The File If It Already Exists.
+    int output_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (output_fd == -1) {
+        perror("Failed to open file");
+        return -1;
+    }
+
+    size_t bytes_remaining = file_size;
+    while (bytes_remaining > 0) {
+        size_t bytes_to_fetch = bytes_remaining < buffer->size ? bytes_remaining : buffer->size;
+        ssize_t bytes_fetched = pread(archive_fd, buffer->data, bytes_to_fetch, data_offset);
+        if (bytes_fetched <= 0) {
+            if (bytes_fetched == 0) {
+                fprintf(stderr, "Failed to read from tar archive: archive is truncated\n");
+            } else {
+                perror("Failed to read from tar archive");
+            }
+            close(output_fd);
+            return -1;
+        }
+        if (write_all(output_fd, buffer->data, bytes_fetched) != 0) {
+            perror("Failed to write to file");
+            close(output_fd);
+            return -1;
+        }
+        data_offset += bytes_fetched;
+        bytes_remaining -= bytes_fetched;
+    }
+
+    if (close(output_fd) != 0) {
+        perror("Failed to close file");
+        return -1;
+    }
+    return 0;
+}
+
+// Reads All 'nbytes' At 'offset' In The Archive Open As 'archive_fd' Into 'data'.
+int pread_all(int archive_fd, char *data, size_t nbytes, off_t offset) {
+    while (nbytes > 0) {
+        ssize_t bytes_fetched = pread(archive_fd, data, nbytes, offset);
+        if (bytes_fetched <= 0) {
+            if (bytes_fetched == 0) {
+                fprintf(stderr, "Failed to read from tar archive: archive is truncated\n");
+            } else {
+                perror("Failed to read from tar archive");
+            }
+            return -1;
+        }
+        data += bytes_fetched;
+        nbytes -= bytes_fetched;
+        offset += bytes_fetched;
+    }
+    return 0;
+}
+
+// Reads The Map At The Start Of The Sparse Member 'entry' Into 'sparse', Using The Copy
+// Buffer Unless The Map Outgrows It.
+// Returns The Number Of Bytes The Map Takes Up, Or -1 On Error.
+ssize_t read_sparse_map(int archive_fd, const index_entry_t *entry, sparse_map_t *sparse,
+                        copy_buffer_t *buffer) {
+    off_t data_offset = entry->header_offset + sizeof(tar_header);
+    char *data = buffer->data;
+    size_t capacity = buffer->size;
+    char *map_data = NULL;
+    ssize_t map_size;
+    while (1) {
+        size_t bytes_to_fetch = entry->size < capacity ? entry->size : capacity;
+        if (pread_all(archive_fd, data, bytes_to_fetch, data_offset) != 0) {
+            free(map_data);
+            return -1;
+        }
+        map_size = sparse_map_decode(sparse, data, bytes_to_fetch, entry->real_size);
+        if (map_size != 0 || bytes_to_fetch == entry->size) {
+            break;
+        }
+
+        // Maps Rarely Fill The Copy Buffer, So A Larger One Is Only Allocated When Needed.
+        capacity *= 2;
+        char *grown = realloc(map_data, capacity);
+        if (grown == NULL) {
+            perror("Failed to allocate sparse map");
+            free(map_data);
+            return -1;
+        }
+        map_data = data = grown;
+    }
+    free(map_data);
+    if (map_size < 0) {
+        return -1;
+    }
+
+    // The Data Of Every Segment Must Make Up The Rest Of The Member.
+    if (map_size == 0 || (uint64_t) map_size > entry->size ||
+        entry->size - map_size != sparse->data_size) {
+        fprintf(stderr, "Failed to read from tar archive: malformed sparse map\n");
+        return -1;
+    }
+    return map_size;
+}
+
+// Extracts The Sparse Member 'entry' By Writing Each Of Its Data Segments At Its Own Offset
+// And Then Setting The File's Full Size, So The Holes Come Back As Holes Rather Than Being
+// Written Out As Zeros, And Extraction Takes Time In Proportion To The Data Alone.
+int extract_sparse_member(int archive_fd, const char *name, const index_entry_t *entry,
+                          copy_buffer_t *buffer) {
+    sparse_map_t sparse;
+    sparse_map_init(&sparse);
+    ssize_t map_size = read_sparse_map(archive_fd, entry, &sparse, buffer);
+    if (map_size < 0) {
+        sparse_map_clear(&sparse);
+        return -1;
+    }
+
+    // Overwrite The File If It Already Exists.
+    int output_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (output_fd == -1) {
+        perror("Failed to open file");
+        sparse_map_clear(&sparse);
+        return -1;
+    }
+
+    int status = 0;
+    off_t archive_offset = entry->header_offset + sizeof(tar_header) + map_size;
+    for (size_t i = 0; i < sparse.count && status == 0; i++) {
+        uint64_t bytes_remaining = sparse.segments[i].length;
+        if (bytes_remaining > 0 && lseek(output_fd, sparse.segments[i].offset, SEEK_SET) == -1) {
+            perror("Failed to seek in file");
+            status = -1;
+        }
+        while (status == 0 && bytes_remaining > 0) {
+            size_t bytes_to_fetch =
+                bytes_remaining < buffer->size ? bytes_remaining : buffer->size;
+            if (pread_all(archive_fd, buffer->data, bytes_to_fetch, archive_offset) != 0) {
+                status = -1;
+            } else if (write_all(output_fd, buffer->data, bytes_to_fetch) != 0) {
+                perror("Failed to write to file");
+                status = -1;
+            }
+            archive_offset += bytes_to_fetch;
+            bytes_remaining -= bytes_to_fetch;
+        }
+    }
+    if (status == 0 && ftruncate(output_fd, sparse.real_size) != 0) {
+        perror("Failed to set file size");
+        status = -1;
+    }
+
+    sparse_map_clear(&sparse);
+    if (close(output_fd) != 0 && status == 0) {
+        perror("Failed to close file");
+        status = -1;
+    }
+    return status;
+}
+
+// Extracts The Sparse Member 'entry', Whose Body Starts At The Reader's Current Position,
+// Like extract_sparse_member But Reading The Archive Strictly In Order, So It Also Works On
+// A Compressed Archive. The Map Is Read A Block At A Time Until It Is Complete.
+int extract_sparse_stream(archive_reader_t *reader, const char *name, const index_entry_t *entry,
+                          copy_buffer_t *buffer) {
+    sparse_map_t sparse;
+    sparse_map_init(&sparse);
+    char *data = buffer->data;
+    size_t capacity = buffer->size;
+    char *map_data = NULL;
+    size_t bytes_read = 0;
+    ssize_t map_size = 0;
+    while (map_size == 0 && bytes_read < entry->size) {
+        // Maps Rarely Fill The Copy Buffer, So A Larger One Is Only Allocated When Needed.
+        if (bytes_read == capacity) {
+            capacity *= 2;
+            char *grown = realloc(map_data, capacity);
+            if (grown == NULL) {
+                perror("Failed to allocate sparse map");
+                map_size = -1;
+                break;
+            }
+            if (map_data == NULL) {
+                memcpy(grown, data, bytes_read);
+            }
+            map_data = data = grown;
+        }
+        size_t bytes_to_fetch = entry->size - bytes_read < BLOCK_SIZE ? entry->size - bytes_read
+                                                                        : BLOCK_SIZE;
+        if (archive_reader_read(reader, data + bytes_read, bytes_to_fetch) != 0) {
+            map_size = -1;
+            break;
+        }
+        bytes_read += bytes_to_fetch;
+        map_size = sparse_map_decode(&sparse, data, bytes_read, entry->real_size);
+    }
+    free(map_data);
+    if (map_size < 0) {
+        sparse_map_clear(&sparse);
+        return -1;
+    }
+
+    // The Data Of Every Segment Must Make Up The Rest Of The Member.
+    if (map_size == 0 || (uint64_t) map_size > entry->size ||
+        entry->size - map_size != sparse.data_size) {
+        fprintf(stderr, "Failed to read from tar archive: malformed sparse map\n");
+        sparse_map_clear(&sparse);
+        return -1;
+    }
+
+    // Overwrite The File If It Already Exists.
+    int output_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (output_fd == -1) {
+        perror("Failed to open file");
+        sparse_map_clear(&sparse);
+        return -1;
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < sparse.count && status == 0; i++) {
+        uint64_t bytes_remaining = sparse.segments[i].length;
+        if (bytes_remaining > 0 && lseek(output_fd, sparse.segments[i].offset, SEEK_SET) == -1) {
+            perror("Failed to seek in file");
+            status = -1;
+        }
+        while (status == 0 && bytes_remaining > 0) {
+            size_t bytes_to_fetch =
+                bytes_remaining < buffer->size ? bytes_remaining : buffer->size;
+            if (archive_reader_read(reader, buffer->data, bytes_to_fetch) != 0) {
+                status = -1;
+            } else if (write_all(output_fd, buffer->data, bytes_to_fetch) != 0) {
+                perror("Failed to write to file");
+                status = -1;
+            }
+            bytes_remaining -= bytes_to_fetch;
+        }
+    }
+    if (status == 0 && ftruncate(output_fd, sparse.real_size) != 0) {
+        perror("Failed to set file size");
+        status = -1;
+    }
+
+    sparse_map_clear(&sparse);
+    if (close(output_fd) != 0 && status == 0) {
+        perror("Failed to close file");
+        status = -1;
+    }
+    return status;
+}
+
+// State shared by the worker threads of a parallel extraction
+typedef struct {
+    pthread_mutex_t lock;
+    const archive_index_t *members;
+    const char *live;
+    size_t next_member;    // Next member for a worker to look at
+    int archive_fd;
+    int failed;
+} extract_pipeline_t;
+
+// Worker Thread: Claims Live Members One At A Time And Extracts Them.
+void *extract_members(void *arg) {
+    extract_pipeline_t *pipeline = arg;
+    copy_buffer_t buffer;
+    int status = copy_buffer_init(&buffer);
+
+    while (status == 0) {
+        pthread_mutex_lock(&pipeline->lock);
+        while (pipeline->next_member < pipeline->members->count &&
+               !pipeline->live[pipeline->next_member]) {
+            pipeline->next_member++;
+        }
+        size_t member_num = pipeline->next_member++;
+        int done = pipeline->failed || member_num >= pipeline->members->count;
+        pthread_mutex_unlock(&pipeline->lock);
+        if (done) {
+            break;
+        }
+
+        const index_entry_t *entry = &pipeline->members->entries[member_num];
+        const char *name = archive_index_name(pipeline->members, member_num);
+        if (entry->flags & INDEX_SPARSE) {
+            status = extract_sparse_member(pipeline->archive_fd, name, entry, &buffer);
+        } else {
+            status = extract_member_pread(pipeline->archive_fd, name,
+                                          entry->header_offset + sizeof(tar_header),
+                                          entry->size, &buffer);
+        }
+    }
+
+    if (status != 0) {
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->failed = 1;
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+    if (buffer.data != NULL) {
+        copy_buffer_free(&buffer);
+    }
+    return NULL;
+}
+
+// Extracts An Archive With 'num_jobs' Worker Threads.
+// A Pre-Scan Of The Headers (Or The Index) Finds The Last Version Of Each Member, Then The
+// Workers Extract Those Distinct Members Concurrently, So A Large File No Longer Holds Up
+// All The Small Ones Behind It.
+int extract_files_parallel(const char *archive_name, const file_list_t *names, int num_jobs) {
+    archive_index_t members;
+    if (load_archive_members(archive_name, &members, NULL, &minitar_opts.filter) != 0) {
+        return -1;
+    }
+
+    extract_pipeline_t pipeline;
+    memset(&pipeline, 0, sizeof(extract_pipeline_t));
+    pipeline.members = &members;
+    char *live = malloc(members.count + 1);
+    pthread_t *workers = calloc(num_jobs, sizeof(pthread_t));
+    if (live == NULL || workers == NULL) {
+        perror("Failed to allocate worker state");
+        free(live);
+        free(workers);
+        archive_index_clear(&members);
+        return -1;
+    }
+    pipeline.live = live;
+    if (find_wanted_members(&members, names, &minitar_opts.filter, live) < 0) {
+        free(live);
+        free(workers);
+        archive_index_clear(&members);
+        return -1;
+    }
+
+    pipeline.archive_fd = open(archive_name, O_RDONLY);
+    if (pipeline.archive_fd == -1) {
+        perror("Failed to open tar archive");
+        free(live);
+        free(workers);
+        archive_index_clear(&members);
+        return -1;
+    }
+    posix_fadvise(pipeline.archive_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Directories Are Created Up Front, In Archive Order, So Every Member Beneath One Finds
+    // It In Place Whichever Worker Gets There First.
+    for (size_t i = 0; i < members.count; i++) {
+        if (live[i] && members.entries[i].typeflag == DIRTYPE) {
+            if (extract_directory(archive_index_name(&members, i)) != 0) {
+                close(pipeline.archive_fd);
+                free(live);
+                free(workers);
+                archive_index_clear(&members);
+                return -1;
+            }
+            live[i] = 0;
+        }
+    }
+    pthread_mutex_init(&pipeline.lock, NULL);
+
+    int num_started = 0;
+    for (; num_started < num_jobs; num_started++) {
+        int err = pthread_create(&workers[num_started], NULL, extract_members, &pipeline);
+        if (err != 0) {
+            errno = err;
+            perror("Failed to start worker thread");
+            pthread_mutex_lock(&pipeline.lock);
+            pipeline.failed = 1;
+            pthread_mutex_unlock(&pipeline.lock);
+            break;
+        }
+    }
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pipeline.lock);
+    if (close(pipeline.archive_fd) != 0) {
+        perror("Failed to close tar archive");
+        pipeline.failed = 1;
+    }
+    free(live);
+    free(workers);
+    archive_index_clear(&members);
+    return pipeline.failed ? -1 : 0;
+}
+
+// Moves A Member Being Extracted Through The Ring On To Its Next Step Now That 'result' Is
+// In. The File Is Opened While The First Chunk Of Its Contents Is Read From The Archive,
+// Then Each Chunk Is Written Out Before The Next Is Read, And The File Is Closed At The End.
+// Returns 0 on success or -1 if the next operation could not be queued
+int advance_extract_slot(io_ring_t *ring, ring_slot_t *slots, int archive_fd,
+                         const io_ring_result_t *result) {
+    size_t slot_num = result->tag >> RING_TAG_SHIFT;
+    ring_slot_t *slot = &slots[slot_num];
+    slot->ops_in_flight--;
+    minitar_stats.ring_operations++;
+    int op = result->tag & RING_TAG_OP_MASK;
+    if (op == RING_OP_OPEN) {
+        if (result->res < 0) {
+            fail_ring_slot(slot, -result->res, "Failed to open file");
+        } else {
+            slot->fd = result->res;
+        }
+    } else if (op == RING_OP_READ) {
+        if (result->res < 0) {
+            fail_ring_slot(slot, -result->res, "Failed to read from tar archive");
+        } else if (result->res == 0) {
+            fail_ring_slot(slot, 0, "Failed to read from tar archive: archive is truncated");
+        } else {
+            slot->data_len = result->res;
+            slot->read_pos += result->res;
+        }
+    } else if (op == RING_OP_WRITE) {
+        if (result->res <= 0) {
+            fail_ring_slot(slot, result->res < 0 ? -result->res : EIO, "Failed to write to file");
+        } else {
+            slot->write_pos += result->res;
+        }
+    } else if (op == RING_OP_CLOSE) {
+        slot->fd = -1;
+        if (result->res < 0) {
+            fail_ring_slot(slot, -result->res, "Failed to close file");
+        }
+    }
+    if (slot->ops_in_flight > 0) {
+        return 0;
+    }
+    if (slot->fd == -1) {
+        if (slot->state == SLOT_LOADING) {
+            slot->state = SLOT_READY;
+        }
+        return 0;
+    }
+
+    // A Short Write Leaves Part Of The Chunk In The Buffer To Go Out Again.
+    int queue_status;
+    if (slot->state == SLOT_FAILED || slot->write_pos == slot->size) {
+        queue_status = io_ring_queue_close(ring, slot->fd, ring_tag(slot_num, RING_OP_CLOSE));
+    } else if (slot->write_pos < slot->read_pos) {
+        size_t chunk_start = slot->read_pos - slot->data_len;
+        queue_status = io_ring_queue_write(ring, slot->fd, slot_num,
+                                           slot->write_pos - chunk_start,
+                                           slot->read_pos - slot->write_pos, slot->write_pos,
+                                           ring_tag(slot_num, RING_OP_WRITE));
+    } else {
+        uint64_t bytes_remaining = slot->size - slot->read_pos;
+        size_t bytes_to_fetch =
+            bytes_remaining < RING_BUFFER_SIZE ? bytes_remaining : RING_BUFFER_SIZE;
+        queue_status = io_ring_queue_read(ring, archive_fd, slot_num, 0, bytes_to_fetch,
+                                          slot->data_offset + slot->read_pos,
+                                          ring_tag(slot_num, RING_OP_READ));
+    }
+    slot->ops_in_flight++;
+    if (queue_status != 0) {
+        perror("Failed to queue file operation");
+        return -1;
+    }
+    return 0;
+}
+
+// Starts Extracting Member 'member_num' In Ring Slot 'slot_num', Opening Its File And
+// Reading The First Chunk Of Its Contents At Once.
+// Returns 0 on success or -1 if the operations could not be queued
+int start_extract_slot(io_ring_t *ring, ring_slot_t *slots, size_t slot_num, int archive_fd,
+                       const archive_index_t *members, size_t member_num) {
+    const index_entry_t *entry = &members->entries[member_num];
+    ring_slot_t *slot = &slots[slot_num];
+    memset(slot, 0, sizeof(ring_slot_t));
+    slot->member_num = member_num;
+    slot->fd = -1;
+    slot->size = entry->size;
+    slot->data_offset = entry->header_offset + sizeof(tar_header);
+    slot->state = SLOT_LOADING;
+
+    // Overwrite The File If It Already Exists.
+    slot->ops_in_flight++;
+    if (io_ring_queue_openat(ring, AT_FDCWD, archive_index_name(members, member_num),
+                             O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666,
+                             ring_tag(slot_num, RING_OP_OPEN)) != 0) {
+        perror("Failed to queue file operation");
+        return -1;
+    }
+    if (slot->size > 0) {
+        size_t bytes_to_fetch = slot->size < RING_BUFFER_SIZE ? slot->size : RING_BUFFER_SIZE;
+        slot->ops_in_flight++;
+        if (io_ring_queue_read(ring, archive_fd, slot_num, 0, bytes_to_fetch, slot->data_offset,
+                               ring_tag(slot_num, RING_OP_READ)) != 0) {
+            perror("Failed to queue file operation");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Extracts Every Live Member That Is Not A Directory Through 'ring', Up To RING_SLOTS Of
+// Them At Once. Sparse Members Are Extracted Directly In Between, As Their Data Lands At
+// Scattered Offsets.
+int extract_ring_members(io_ring_t *ring, const archive_index_t *members, const char *live,
+                         int archive_fd, ring_slot_t *slots, copy_buffer_t *buffer) {
+    size_t next_member = 0;
+    int status = 0;
+    while (1) {
+        // Free The Slots Of Members That Are Done, Then Start New Ones In Them.
+        for (size_t i = 0; i < RING_SLOTS; i++) {
+            ring_slot_t *slot = &slots[i];
+            if ((slot->state == SLOT_READY || slot->state == SLOT_FAILED) &&
+                slot->ops_in_flight == 0) {
+                if (slot->state == SLOT_FAILED) {
+                    report_ring_slot(slot, archive_index_name(members, slot->member_num));
+                    status = -1;
+                }
+                slot->state = SLOT_EMPTY;
+            }
+        }
+        for (size_t i = 0; status == 0 && i < RING_SLOTS; i++) {
+            if (slots[i].state != SLOT_EMPTY) {
+                continue;
+            }
+            while (status == 0 && next_member < members->count &&
+                   (!live[next_member] || (members->entries[next_member].flags & INDEX_SPARSE))) {
+                if (live[next_member]) {
+                    status = extract_sparse_member(archive_fd,
+                                                   archive_index_name(members, next_member),
+                                                   &members->entries[next_member], buffer);
+                }
+                next_member++;
+            }
+            if (status != 0 || next_member == members->count) {
+                break;
+            }
+            status = start_extract_slot(ring, slots, i, archive_fd, members, next_member++);
+        }
+        if (status != 0 || io_ring_pending(ring) == 0) {
+            break;
+        }
+
+        // Wait For More Operations To Finish, Moving Each Member On To Its Next Step.
+        if (io_ring_wait(ring) != 0) {
+            perror("Failed to wait for file operations");
+            status = -1;
+            break;
+        }
+        io_ring_result_t result;
+        while (status == 0 && io_ring_next(ring, &result) == 1) {
+            status = advance_extract_slot(ring, slots, archive_fd, &result);
+        }
+    }
+    drain_ring(ring, slots);
+    return status;
+}
+
+// Extracts An Uncompressed Archive Through 'ring'.
+// As With extract_files_parallel, The Last Version Of Each Wanted Member Is Found Up Front
+// And Directories Are Created First, But The Files Are Then Opened, Filled And Closed Many
+// At A Time By The Kernel Rather Than By One Thread Per Job.
+int extract_files_ring(const char *archive_name, const file_list_t *names, io_ring_t *ring) {
+    archive_index_t members;
+    if (load_archive_members(archive_name, &members, NULL, &minitar_opts.filter) != 0) {
+        return -1;
+    }
+    char *live = malloc(members.count + 1);
+    ring_slot_t *slots = calloc(RING_SLOTS, sizeof(ring_slot_t));
+    if (live == NULL || slots == NULL) {
+        perror("Failed to allocate member table");
+        free(live);
+        free(slots);
+        archive_index_clear(&members);
+        return -1;
+    }
+    for (size_t i = 0; i < RING_SLOTS; i++) {
+        slots[i].fd = -1;
+    }
+
+    int status = 0;
+    int archive_fd = -1;
+    if (find_wanted_members(&members, names, &minitar_opts.filter, live) < 0) {
+        status = -1;
+    } else if ((archive_fd = open(archive_name, O_RDONLY)) == -1) {
+        perror("Failed to open tar archive");
+        status = -1;
+    }
+
+    // Directories Are Created Up Front, In Archive Order, So Every File Beneath One Finds It
+    // In Place Whenever The Kernel Gets To Opening It.
+    for (size_t i = 0; status == 0 && i < members.count; i++) {
+        if (live[i] && members.entries[i].typeflag == DIRTYPE) {
+            status = extract_directory(archive_index_name(&members, i));
+            live[i] = 0;
+        }
+    }
+
+    copy_buffer_t buffer = {NULL, 0};
+    if (status == 0) {
+        status = copy_buffer_init(&buffer);
+    }
+    if (status == 0) {
+        posix_fadvise(archive_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        status = extract_ring_members(ring, &members, live, archive_fd, slots, &buffer);
+    }
+
+    if (archive_fd != -1 && close(archive_fd) != 0) {
+        perror("Failed to close tar archive");
+        status = -1;
+    }
+    if (buffer.data != NULL) {
+        copy_buffer_free(&buffer);
+    }
+    free(slots);
+    free(live);
+    archive_index_clear(&members);
+    return status;
+}
+
+// Creates Each Directory Above The Member 'name' That Is Not Already In 'made', Adding It
+// There, For When The Directory's Own Member May Have Been Left Out.
+int make_parent_directories(file_list_t *made, const char *name) {
+    char *path = strdup(name);
+    if (path == NULL) {
+        perror("Failed to allocate member name");
+        return -1;
+    }
+    int status = 0;
+    for (char *slash = strchr(path, '/'); status == 0 && slash != NULL && slash[1] != '\0';
+         slash = strchr(slash + 1, '/')) {
+        char next = slash[1];
+        slash[1] = '\0';
+        if (!file_list_contains(made, path)) {
+            status = extract_directory(path);
+            if (status == 0 && file_list_add(made, path) != 0) {
+                perror("Failed to add file to list");
+                status = -1;
+            }
+        }
+        slash[1] = next;
+    }
+    free(path);
+    return status;
+}
+
+// Extracts An Archive Coming In On stdin In A Single Pass, As It Can Only Be Read Once.
+// With No Looking Ahead For Later Versions, Every Version Of A Member Is Written In Turn
+// (The Last One Wins), And Every Unwanted Body Is Read And Thrown Away. When Members Are
+// Being Picked Out, The Directories Above Each One Extracted Are Created As It Comes, As
+// Their Own Members May Have Been Left Out.
+int extract_archive_stream(const char *archive_name, const file_list_t *names,
+                           const member_filter_t *filter) {
+    int selective = names->size > 0 || member_filter_active(filter);
+    file_list_t wanted, found, made;
+    file_list_init(&wanted);
+    file_list_init(&found);
+    file_list_init(&made);
+    copy_buffer_t buffer;
+    if (make_wanted_names(names, &wanted) != 0 || copy_buffer_init(&buffer) != 0) {
+        file_list_clear(&wanted);
+        return -1;
+    }
+    archive_reader_t reader;
+    if (archive_reader_open(&reader, archive_name, MADV_SEQUENTIAL) != 0) {
+        copy_buffer_free(&buffer);
+        file_list_clear(&wanted);
+        return -1;
+    }
+
+    const tar_header *archive_header;
+    int status;
+    while ((status = archive_reader_next_header(&reader, &archive_header)) == 1) {
+        const char *name = reader.name;
+        size_t body_offset = reader.offset;
+        size_t file_size;
+        if (parse_header_size(archive_header, &file_size) != 0) {
+            status = -1;
+            break;
+        }
+
+        int result = names->size == 0 ? 1 : member_wanted(&wanted, &found, name);
+        if (result == 1 && !member_filter_match(filter, name)) {
+            result = 0;
+        }
+        if (result == 1 && selective && make_parent_directories(&made, name) != 0) {
+            result = -1;
+        }
+
+        if (result == 0) {
+            result = archive_reader_skip(&reader, file_size);
+        } else if (result == 1 && archive_header->typeflag == DIRTYPE) {
+            result = extract_directory(name);
+            if (result == 0) {
+                result = archive_reader_skip(&reader, file_size);
+            }
+        } else if (result == 1 && reader.sparse_size >= 0) {
+            index_entry_t entry = {
+                .size = file_size,
+                .flags = INDEX_SPARSE,
+                .real_size = reader.sparse_size,
+            };
+            result = extract_sparse_stream(&reader, name, &entry, &buffer);
+            // Only The Padding After The Sparse Data Is Left To Get Past.
+            if (result == 0) {
+                result = archive_reader_seek(&reader, body_offset + padded_size(file_size));
+            }
+        } else if (result == 1) {
+            result = extract_member(&reader, name, file_size, &buffer);
+        }
+        if (result != 0) {
+            status = -1;
+            break;
+        }
+    }
+
+    if (status == 0) {
+        status = check_names_found(&wanted, &found);
+    }
+    copy_buffer_free(&buffer);
+    file_list_clear(&wanted);
+    file_list_clear(&found);
+    file_list_clear(&made);
+    if (archive_reader_close(&reader) != 0 || status != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int extract_files_from_archive(const char *archive_name, const file_list_t *names) {
+    if (is_stdio_archive(archive_name)) {
+        return extract_archive_stream(archive_name, names, &minitar_opts.filter);
+    }
+
+    // The Ring And The Workers Read At Offsets, Which Only Works On An Uncompressed Archive; A
+    // Compressed One Is Decompressed Front To Back, In One Pass.
+    compress_type_t compression;
+    if (archive_compression(archive_name, &compression) != 0) {
+        return -1;
+    }
+    if (compression == COMPRESS_NONE) {
+        io_ring_t *ring;
+        int ring_status = open_io_ring(&ring);
+        if (ring_status == -1) {
+            return -1;
+        }
+        if (ring_status == 0) {
+            int status = extract_files_ring(archive_name, names, ring);
+            io_ring_free(ring);
+            return status;
+        }
+    }
+    if (minitar_opts.num_jobs > 1 && compression == COMPRESS_NONE) {
+        return extract_files_parallel(archive_name, names, minitar_opts.num_jobs);
+    }
+
+    // Without A Current Index, Finding The Live Members Of A Compressed Archive Would Mean
+    // Decompressing All Of It Once Just To Read The Headers, So It Is Extracted In A Single
+    // Pass Instead, As From stdin. Checksums Are Only Verified By That Pass Too.
+    if (compression != COMPRESS_NONE) {
+        archive_index_t index;
+        int index_status =
+            minitar_opts.verify_checksums ? 1 : archive_index_load(&index, archive_name);
+        if (index_status == -1) {
+            return -1;
+        } else if (index_status == 1) {
+            return extract_archive_stream(archive_name, names, &minitar_opts.filter);
+        }
+        archive_index_clear(&index);
+    }
+
+    // Find The Last Version Of Each Member Up Front (From The Index, Or A Walk Over The
+    // Headers), So Superseded Versions Are Skipped Rather Than Written And Overwritten.
+    archive_index_t members;
+    if (load_archive_members(archive_name, &members, NULL, &minitar_opts.filter) != 0) {
+        return -1;
+    }
+    char *live = malloc(members.count + 1);
+    if (live == NULL) {
+        perror("Failed to allocate member table");
+        archive_index_clear(&members);
+        return -1;
+    }
+    long num_live = find_wanted_members(&members, names, &minitar_opts.filter, live);
+    if (num_live < 0) {
+        free(live);
+        archive_index_clear(&members);
+        return -1;
+    }
+
+    copy_buffer_t buffer;
+    if (copy_buffer_init(&buffer) != 0) {
+        free(live);
+        archive_index_clear(&members);
+        return -1;
+    }
+
+    // Opening The Existing Tar Archive For Reading.
+    // Bodies Are Read In Archive Order, So Ask For Aggressive Read-Ahead.
+    archive_reader_t reader;
+    if (archive_reader_open(&reader, archive_name, MADV_SEQUENTIAL) != 0) {
+        copy_buffer_free(&buffer);
+        free(live);
+        archive_index_clear(&members);
+        return -1;
+    }
+    archive_reader_use_frames(&reader, &members);
+
+    // The Member Table Says Exactly Where Each Body Starts, And They Only Ever Move Forwards.
+    // Every Other Body Is Seeked Past Unread, And Once The Last Member Wanted Is Out, Nothing
+    // After It Is Read At All.
+    int status = 0;
+    for (size_t i = 0; i < members.count && num_live > 0 && status == 0; i++) {
+        const index_entry_t *entry = &members.entries[i];
+        if (!live[i]) {
+            continue;
+        }
+        num_live--;
+        if (entry->typeflag == DIRTYPE) {
+            status = extract_directory(archive_index_name(&members, i));
+            continue;
+        }
+        if (archive_reader_seek(&reader, entry->header_offset + sizeof(tar_header)) != 0) {
+            status = -1;
+        } else if (entry->flags & INDEX_SPARSE) {
+            status = extract_sparse_stream(&reader, archive_index_name(&members, i), entry,
+                                           &buffer);
+        } else {
+            status = extract_member(&reader, archive_index_name(&members, i), entry->size,
+                                    &buffer);
+        }
+    }
+    copy_buffer_free(&buffer);
+    free(live);
+    archive_index_clear(&members);
+
+    // Close The Tar Archive.
+    if (archive_reader_close(&reader) != 0 || status != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Copies 'nbytes' Starting At 'offset' In 'input_fd' To The Current Position Of 'output_fd'.
+// Uses copy_file_range When --zero-copy Is Set (And The Kernel Supports It), Otherwise Moves
+// The Data Through 'buffer'.
+int copy_archive_range(int input_fd, off_t offset, size_t nbytes, int output_fd,
+                       copy_buffer_t *buffer) {
+    while (minitar_opts.zero_copy && nbytes > 0) {
+        ssize_t bytes_copied = copy_file_range(input_fd, &offset, output_fd, NULL, nbytes, 0);
+        if (bytes_copied <= 0) {
+            // Anything Left Over (Including After An Unsupported Call) Goes Through The Buffer.
+            break;
+        }
+        nbytes -= bytes_copied;
+    }
+
+    while (nbytes > 0) {
+        size_t bytes_to_fetch = nbytes < buffer->size ? nbytes : buffer->size;
+        ssize_t bytes_fetched = pread(input_fd, buffer->data, bytes_to_fetch, offset);
+        if (bytes_fetched <= 0) {
+            if (bytes_fetched == 0) {
+                fprintf(stderr, "Failed to read from tar archive: archive is truncated\n");
+            } else {
+                perror("Failed to read from tar archive");
+            }
+            return -1;
+        }
+        if (write_all(output_fd, buffer->data, bytes_fetched) != 0) {
+            perror("Failed to write to tar archive");
+            return -1;
+        }
+        offset += bytes_fetched;
+        nbytes -= bytes_fetched;
+    }
+    return 0;
+}
+
+// Writes The Live Members Of 'members' From 'input_fd' To 'output_fd', Followed By The Footer.
+// Runs Of Adjacent Live Members Are Copied As One Range. Each Member Kept Is Also Recorded
+// In 'new_index' At Its New Offset, Unless It Is NULL.
+int write_live_members(int input_fd, int output_fd, const archive_index_t *members,
+                       const char *live, archive_index_t *new_index, copy_buffer_t *buffer) {
+    static const char empty_footer[BLOCK_SIZE * NUM_TRAILING_BLOCKS] = {0};
+    off_t output_offset = 0;
+    size_t i = 0;
+
+    while (i < members->count) {
+        if (!live[i]) {
+            i++;
+            continue;
+        }
+
+        // Extend The Range Over Every Following Member That Is Also Kept.
+        // A Member Starts With Any Extended Headers In Front Of Its Own Header.
+        off_t range_start = members->entries[i].header_offset - members->entries[i].ext_size;
+        off_t range_end = range_start;
+        for (; i < members->count && live[i] &&
+               (off_t) (members->entries[i].header_offset - members->entries[i].ext_size) ==
+                   range_end;
+             i++) {
+            index_entry_t entry = members->entries[i];
+            entry.header_offset = output_offset + (range_end - range_start) + entry.ext_size;
+            if (new_index != NULL &&
+                archive_index_add(new_index, archive_index_name(members, i), &entry) != 0) {
+                perror("Failed to add member to archive index");
+                return -1;
+            }
+            range_end += entry.ext_size + sizeof(tar_header) + padded_size(entry.size);
+        }
+
+        if (copy_archive_range(input_fd, range_start, range_end - range_start, output_fd,
+                               buffer) != 0) {
+            return -1;
+        }
+        output_offset += range_end - range_start;
+    }
+
+    if (write_all(output_fd, empty_footer, sizeof(empty_footer)) != 0) {
+        perror("Failed to write to tar archive");
+        return -1;
+    }
+    return 0;
+}
+
+int compact_archive(const char *archive_name) {
+    // Live Members Are Copied As Raw Byte Ranges, Which A Compressed Archive Does Not Have.
+    compress_type_t compression;
+    if (archive_compression(archive_name, &compression) != 0) {
+        return -1;
+    }
+    if (compression != COMPRESS_NONE) {
+        fprintf(stderr, "Failed to compact tar archive: compressed archives are not supported\n");
+        return -1;
+    }
+
+    // Find The Last Version Of Each Member, From The Index Or A Walk Over The Headers.
+    archive_index_t members;
+    int indexed;
+    if (load_archive_members(archive_name, &members, &indexed, NULL) != 0) {
+        return -1;
+    }
+
+    // A Current Index (Or --index) Means The Compacted Archive Gets One Too.
+    struct stat stat_buf;
+    archive_index_t index;
+    archive_index_init(&index);
+    archive_index_t *new_index = indexed || minitar_opts.write_index ? &index : NULL;
+
+    char *live = malloc(members.count + 1);
+    copy_buffer_t buffer;
+    buffer.data = NULL;
+    if (live == NULL || find_live_members(&members, live) < 0 || copy_buffer_init(&buffer) != 0) {
+        free(live);
+        archive_index_clear(&members);
+        return -1;
+    }
+
+    // The New Archive Is Written Next To The Old One, Then Renamed Over It In One Step, So
+    // The Archive Is Never Seen Half-Compacted.
+    char tmp_name[PATH_MAX];
+    int input_fd = open(archive_name, O_RDONLY);
+    int output_fd = -1;
+    if (input_fd != -1 && fstat(input_fd, &stat_buf) == 0 &&
+        snprintf(tmp_name, PATH_MAX, "%s.XXXXXX", archive_name) < PATH_MAX) {
+        output_fd = mkstemp(tmp_name);
+    }
+    if (input_fd == -1 || output_fd == -1) {
+        perror("Failed to open tar archive");
+        if (input_fd != -1) {
+            close(input_fd);
+        }
+        copy_buffer_free(&buffer);
+        free(live);
+        archive_index_clear(&members);
+        return -1;
+    }
+    posix_fadvise(input_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int status = write_live_members(input_fd, output_fd, &members, live, new_index, &buffer);
+    if (status == 0 && (fchmod(output_fd, stat_buf.st_mode & 07777) != 0 ||
+                        fsync(output_fd) != 0)) {
+        perror("Failed to write to tar archive");
+        status = -1;
+    }
+    if (close(output_fd) != 0 && status == 0) {
+        perror("Failed to close tar archive");
+        status = -1;
+    }
+    close(input_fd);
+    if (status == 0 && rename(tmp_name, archive_name) != 0) {
+        perror("Failed to replace tar archive");
+        status = -1;
+    }
+    if (status != 0) {
+        unlink(tmp_name);
+    }
+
+    // The Old Index No Longer Matches, So It Is Replaced Or Removed.
+    if (status == 0 && new_index != NULL) {
+        status = archive_index_save(new_index, archive_name);
+    } else if (status == 0) {
+        archive_index_remove(archive_name);
+    }
+
+    copy_buffer_free(&buffer);
+    free(live);
+    archive_index_clear(&index);
+    archive_index_clear(&members);
+    return status;
+}
+
+// Compares The Contents Of The File 'file_name' With A Member's Body In The Archive.
+// Returns 1 if they are identical, 0 if they differ or -1 on error.
+int member_contents_match(int archive_fd, const index_entry_t *entry, const char *file_name,
+                          copy_buffer_t *buffer) {
+    // The Body Of A Sparse Member Is Not The File's Bytes, So It Is Simply Archived Again.
+    // The Same Goes For A Compressed Archive, Which Has No fd To Read Bodies From.
+    if ((entry->flags & INDEX_SPARSE) || archive_fd == -1) {
+        return 0;
+    }
+
+    int input_fd = open(file_name, O_RDONLY);
+    if (input_fd == -1) {
+        perror("Failed to open file");
+        return -1;
+    }
+
+    // Each Half Of The Buffer Holds One Side Of The Comparison.
+    size_t half = buffer->size / 2;
+    char *archive_data = buffer->data;
+    char *file_data = buffer->data + half;
+    off_t offset = 0;
+    int match = 1;
+    while (match == 1 && (size_t) offset < entry->size) {
+        size_t bytes_to_fetch = entry->size - offset < half ? entry->size - offset : half;
+        ssize_t archive_bytes = pread(archive_fd, archive_data, bytes_to_fetch,
+                                      entry->header_offset + sizeof(tar_header) + offset);
+        ssize_t file_bytes = pread(input_fd, file_data, bytes_to_fetch, offset);
+        if (archive_bytes < 0 || file_bytes < 0) {
+            perror("Failed to compare file contents");
+            match = -1;
+        } else if (archive_bytes != bytes_to_fetch || file_bytes != bytes_to_fetch ||
+                   memcmp(archive_data, file_data, bytes_to_fetch) != 0) {
+            match = 0;
+        }
+        offset += bytes_to_fetch;
+    }
+
+    close(input_fd);
+    return match;
+}
+
+// Decides Whether The File 'file_name' Still Matches Its Newest Archived Version 'entry'.
+// Size And Permissions Must Match, Plus Either The mtime Or (With --check-contents) The
+// Contents Themselves, Which Also Catches Files That Were Only Touched.
+// Returns 1 if the file is unchanged, 0 if it changed or -1 on error.
+int member_unchanged(int archive_fd, const index_entry_t *entry, const char *file_name,
+                     copy_buffer_t *buffer) {
+    char err_msg[MAX_MSG_LEN];
+    struct stat stat_buf;
+    if (stat(file_name, &stat_buf) != 0) {
+        snprintf(err_msg, MAX_MSG_LEN, "Failed to stat file %s", file_name);
+        perror(err_msg);
+        return -1;
+    }
+
+    if ((uint64_t) stat_buf.st_size != entry->real_size ||
+        (stat_buf.st_mode & 07777) != entry->mode) {
+        return 0;
+    }
+    if (!minitar_opts.check_contents) {
+        return stat_buf.st_mtime == entry->mtime;
+    }
+    return member_contents_match(archive_fd, entry, file_name, buffer);
+}
+
+int expand_update_files(const file_list_t *files, file_list_t *expanded) {
+    tree_walk_t walk;
+    if (tree_walk_start(&walk, files, NULL) != 0) {
+        return -1;
+    }
+
+    int status = 0;
+    int walk_status;
+    walk_entry_t entry;
+    char member_name[MEMBER_NAME_MAX];
+    while (status == 0 && (walk_status = tree_walk_next(&walk, &entry)) == 1) {
+        // Name Each Directory As Its Header Does, With A Trailing Slash.
+        struct stat stat_buf;
+        int is_dir = stat(entry.path, &stat_buf) == 0 && S_ISDIR(stat_buf.st_mode);
+        if (format_member_name(entry.path, is_dir, member_name) == -1) {
+            status = -1;
+        } else if (file_list_add(expanded, member_name) != 0) {
+            perror("Failed to add file to list");
+            status = -1;
+        }
+        free(entry.path);
+    }
+    if (walk_status == -1) {
+        status = -1;
+    }
+    if (tree_walk_finish(&walk) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+// Returns 1 If The Member Name 'name' Is That Of A Directory.
+static int is_dir_member_name(const char *name) {
+    size_t name_len = strlen(name);
+    return name_len > 0 && name[name_len - 1] == '/';
+}
+
+int get_changed_files(const char *archive_name, const file_list_t *files, file_list_t *changed) {
+    archive_index_t members;
+    if (load_archive_members(archive_name, &members, NULL, NULL) != 0) {
+        return -1;
+    }
+
+    copy_buffer_t buffer;
+    if (copy_buffer_init(&buffer) != 0) {
+        archive_index_clear(&members);
+        return -1;
+    }
+    int archive_fd = open(archive_name, O_RDONLY);
+    if (archive_fd == -1) {
+        perror("Failed to open tar archive");
+        copy_buffer_free(&buffer);
+        archive_index_clear(&members);
+        return -1;
+    }
+    compress_type_t compression;
+    if (compress_detect(archive_fd, &compression) != 0) {
+        close(archive_fd);
+        copy_buffer_free(&buffer);
+        archive_index_clear(&members);
+        return -1;
+    }
+    if (compression != COMPRESS_NONE) {
+        close(archive_fd);
+        archive_fd = -1;
+    }
+
+    // Walk Backwards So Each File Is Only Compared With The Newest Version Of Its Name.
+    file_list_t seen, unchanged;
+    file_list_init(&seen);
+    file_list_init(&unchanged);
+    int status = 0;
+    for (size_t i = members.count; status == 0 && i-- > 0;) {
+        const char *name = archive_index_name(&members, i);
+        if (!file_list_contains(files, name) || file_list_contains(&seen, name)) {
+            continue;
+        }
+        if (file_list_add(&seen, name) != 0) {
+            perror("Failed to add file to list");
+            status = -1;
+            break;
+        }
+        if (is_dir_member_name(name)) {
+            continue;
+        }
+
+        int result = member_unchanged(archive_fd, &members.entries[i], name, &buffer);
+        if (result == 1 && file_list_add(&unchanged, name) != 0) {
+            perror("Failed to add file to list");
+            result = -1;
+        }
+        status = result == -1 ? -1 : 0;
+    }
+
+    // Keep The Original Order Of 'files' For Whatever Did Change.
+    // Appending A Directory Walks Everything Beneath It, So An Archived One Is Never Appended
+    // Again (The Files There Are Compared On Their Own), While A New One Is Appended In
+    // Place Of Everything Beneath It.
+    const char *new_dir = NULL;
+    size_t new_dir_len = 0;
+    for (node_t *curr_file = files->head; status == 0 && curr_file != NULL;
+         curr_file = curr_file->next) {
+        if (new_dir != NULL && strncmp(curr_file->name, new_dir, new_dir_len) == 0) {
+            continue;
+        }
+        new_dir = NULL;
+        if (is_dir_member_name(curr_file->name) && file_list_contains(&seen, curr_file->name)) {
+            continue;
+        } else if (is_dir_member_name(curr_file->name)) {
+            new_dir = curr_file->name;
+            new_dir_len = strlen(new_dir);
+            if (file_list_add(changed, curr_file->name) != 0) {
+                perror("Failed to add file to list");
+                status = -1;
+            }
+        } else if (file_list_contains(&unchanged, curr_file->name)) {
+            minitar_stats.unchanged_files++;
+        } else if (file_list_add(changed, curr_file->name) != 0) {
+            perror("Failed to add file to list");
+            status = -1;
+        }
+    }
+
+    file_list_clear(&seen);
+    file_list_clear(&unchanged);
+    if (archive_fd != -1) {
+        close(archive_fd);
+    }
+    copy_buffer_free(&buffer);
+    archive_index_clear(&members);
+    return status;
+}
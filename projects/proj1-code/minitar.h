@@ -2,7 +2,12 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #ifndef _MINITAR_H
 #define _MINITAR_H
+#include <stddef.h>
+#include <stdio.h>
+
+#include "compress_stream.h"
 #include "file_list.h"
+#include "member_filter.h"
 
 // Standard tar header layout defined by POSIX
 typedef struct {
@@ -41,13 +46,84 @@ typedef struct {
     char padding[12];
 } tar_header;
 
+// Runtime options shared by all archive operations, set from the command line
+typedef struct {
+    // Bytes moved per read/write when copying member contents, a multiple of 512
+    size_t buffer_size;
+    // Copy member contents into the archive inside the kernel (copy_file_range/sendfile)
+    int zero_copy;
+    // Write a member index ("ARCHIVE.idx") when creating or appending to an archive
+    int write_index;
+    // Number of threads used to prepare members when creating or appending, or to
+    // extract distinct members concurrently
+    int num_jobs;
+    // Only update files whose size, permissions or mtime differ from the archived version
+    int incremental;
+    // With 'incremental', compare contents instead of mtime, so touched files are skipped
+    int check_contents;
+    // Print minitar_stats to stderr once the operation finishes
+    int print_stats;
+    // Check every header's checksum while listing or extracting, failing on a mismatch
+    int verify_checksums;
+    // Look for holes in the files being archived, storing files that have some as sparse
+    // members that hold only their data
+    int sparse;
+    // Compression for a new archive; existing archives are read (and appended to) with
+    // whatever compression they were written with
+    compress_type_t compression;
+    // Open, stat, read, write and close member files through io_uring, with many of these
+    // operations in flight at once, instead of one blocking system call after another (or
+    // worker threads), when creating or appending to an archive or extracting an
+    // uncompressed one from a file. Without io_uring, the usual system calls are used
+    int io_uring;
+    // --include/--exclude patterns picking the files create and append archive, and the
+    // members list and extract work on
+    member_filter_t filter;
+} minitar_options_t;
+
+extern minitar_options_t minitar_opts;
+
+// Counters collected while running an operation, reported with --stats
+typedef struct {
+    // Older versions of members that extraction skipped over, and their total size
+    size_t superseded_members;
+    size_t superseded_bytes;
+    // Files an incremental update left out because they matched the archived version
+    size_t unchanged_files;
+    // Owner and group name lookups answered from the cache versus the system databases
+    size_t name_cache_hits;
+    size_t name_cache_misses;
+    // Headers whose checksum was checked with --verify
+    size_t verified_headers;
+    // Files stored as sparse members, and the bytes of holes left out of the archive
+    size_t sparse_members;
+    size_t hole_bytes;
+    // Times reading a compressed archive jumped ahead by decompressing from a later frame
+    size_t frame_jumps;
+    // File operations completed through io_uring with --io-uring
+    size_t ring_operations;
+} minitar_stats_t;
+
+extern minitar_stats_t minitar_stats;
+
+// Size of a tar block: headers take one, and member bodies and buffer sizes are whole
+// multiples of it
+#define BLOCK_SIZE 512
+
+// Archive name that stands for stdout when creating an archive, or stdin when listing or
+// extracting one. Such an archive is written or read front to back in one pass, without
+// an index.
+#define STDIO_ARCHIVE_NAME "-"
+
 /*
  * Create a new archive file with the name 'archive_name'.
  * The archive should contain all files stored in the 'files' list.
+ * A directory in the list is stored along with everything beneath it.
  * You can assume in this project that at least one member file is specified.
  * You may also assume that all the elements of 'files' exist.
  * If an archive of the specified name already exists, you should overwrite it
- * with the result of this operation.
+ * with the result of this operation. It is written to stdout if 'archive_name'
+ * is STDIO_ARCHIVE_NAME.
  * This function should return 0 upon success or -1 if an error occurred
  */
 int create_archive(const char *archive_name, const file_list_t *files);
@@ -62,7 +138,8 @@ int append_files_to_archive(const char *archive_name, const file_list_t *files);
 
 /*
  * Add the name of each file contained in the archive identified by 'archive_name'
- * to the 'files' list.
+ * to the 'files' list, leaving out any that minitar_opts.filter does not pass.
+ * It is read from stdin if 'archive_name' is STDIO_ARCHIVE_NAME.
  * NOTE: This function is most obviously relevant to implementing minitar's list
  * operation, but think about how you can reuse it for the update operation.
  * This function should return 0 upon success or -1 if an error occurred.
@@ -72,11 +149,54 @@ int get_archive_file_list(const char *archive_name, file_list_t *files);
 /*
  * Write each file contained within the archive identified by 'archive_name'
  * as a new file to the current working directory.
+ * If 'names' is not empty, only the members it names are written, along with
+ * everything beneath any directory it names; it is an error for a name to
+ * match nothing in the archive.
+ * Members minitar_opts.filter does not pass are left out as well, except for
+ * directories holding members that are written.
+ * The archive is read from stdin if 'archive_name' is STDIO_ARCHIVE_NAME. As it
+ * can only be read once, every version of a member is written in turn, and
+ * names that match nothing are only reported once the rest has been extracted.
  * If there are multiple versions of the same file present in the archive,
  * then only the most recently added version should be present as a new file
  * at the end of the extraction process.
  * This function should return 0 upon success or -1 if an error occurred.
  */
-int extract_files_from_archive(const char *archive_name);
+int extract_files_from_archive(const char *archive_name, const file_list_t *names);
+
+/*
+ * Add to 'expanded' the member name of each path in 'files', expanding directories into
+ * everything beneath them as archive creation would walk them. Directories are named with
+ * a trailing slash, as in their headers.
+ * This function should return 0 upon success or -1 if an error occurred.
+ */
+int expand_update_files(const file_list_t *files, file_list_t *expanded);
+
+/*
+ * Add to 'changed' each file in 'files' that differs from the most recent version of it
+ * in the archive identified by 'archive_name', keeping the order of 'files'.
+ * A file is unchanged when its size and permissions match the archived version along with
+ * its modification time, or its contents if minitar_opts.check_contents is set.
+ * Files not present in the archive at all are always considered changed.
+ * Directories (names ending in '/') already in the archive are passed over, as appending
+ * one would append everything beneath it; a new one is added in place of everything
+ * beneath it.
+ * This function should return 0 upon success or -1 if an error occurred.
+ */
+int get_changed_files(const char *archive_name, const file_list_t *files, file_list_t *changed);
+
+/*
+ * Rewrite the archive identified by 'archive_name' so that it only contains the most
+ * recently added version of each member, in their original order.
+ * The compacted archive replaces the original in a single rename, so an interrupted
+ * compaction leaves the original archive untouched.
+ * This function should return 0 upon success or -1 if an error occurred.
+ */
+int compact_archive(const char *archive_name);
+
+/*
+ * Print the counters collected in minitar_stats to 'out'.
+ */
+void print_stats(FILE *out);
 
 #endif    // _MINITAR_H
@@ -1,27 +1,199 @@
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "file_list.h"
 #include "minitar.h"
 
+#define MAX_JOBS_PER_CPU 4
+
+#define USAGE                                                                        \
+    "Usage: %s -c|a|t|u|x|k -f ARCHIVE|- [--buffer-size BYTES] [-j JOBS] [--zero-copy]\n" \
+    "       [--index] [--incremental [--check-contents]] [--verify] [-S|--sparse]\n"    \
+    "       [-z|--gzip|--zstd] [--include PATTERN]... [--exclude PATTERN]... [--stats]\n" \
+    "       [--io-uring] [FILE...]\n"
+
+// Parses A Byte Count With An Optional K/M Suffix (e.g. "64K", "1M"), Which Must Be A
+// Non-Zero Multiple Of The 512 Byte Tar Block.
+// Returns 0 on success or -1 if the string is not a valid size.
+int parse_size(const char *size_string, size_t *size) {
+    // strtoull Would Skip Leading Spaces And Quietly Negate A Leading '-'.
+    if (*size_string < '0' || *size_string > '9') {
+        return -1;
+    }
+    char *end_pointer;
+    errno = 0;
+    unsigned long long value = strtoull(size_string, &end_pointer, 10);
+    if (errno == ERANGE || value > SIZE_MAX) {
+        return -1;
+    }
+
+    // Check The Suffix Would Not Shift Any Bits Off The Top Before Applying It.
+    int shift = 0;
+    if (*end_pointer == 'K' || *end_pointer == 'k') {
+        shift = 10;
+        end_pointer++;
+    } else if (*end_pointer == 'M' || *end_pointer == 'm') {
+        shift = 20;
+        end_pointer++;
+    }
+    if (value > (SIZE_MAX >> shift)) {
+        return -1;
+    }
+    value <<= shift;
+
+    if (*end_pointer != '\0' || value == 0 || value % BLOCK_SIZE != 0) {
+        return -1;
+    }
+    *size = value;
+    return 0;
+}
+
+// Returns The Most Jobs -j Accepts: A Few Per Online CPU, So Workers Waiting On I/O Still
+// Leave Every CPU Busy Without Starting An Unbounded Number Of Threads.
+long max_jobs(void) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (num_cpus > 0 ? num_cpus : 1) * MAX_JOBS_PER_CPU;
+}
+
+// Parses A Job Count, Which Must Be A Whole Number From 1 To max_jobs().
+// Returns 0 on success or -1 if the string is not a valid count.
+int parse_jobs(const char *jobs_string, int *num_jobs) {
+    // strtol Would Skip Leading Spaces And Accept A Sign.
+    if (*jobs_string < '0' || *jobs_string > '9') {
+        return -1;
+    }
+    char *end_pointer;
+    errno = 0;
+    long value = strtol(jobs_string, &end_pointer, 10);
+    if (errno == ERANGE || *end_pointer != '\0' || value < 1 || value > max_jobs()) {
+        return -1;
+    }
+    *num_jobs = value;
+    return 0;
+}
+
+// Returns 1 If 'path' Is A Directory Whose Member (Its Name With A Trailing Slash) Is In
+// 'files_in_archive', Otherwise 0.
+int directory_archived(const file_list_t *files_in_archive, const char *path) {
+    struct stat stat_buf;
+    size_t path_len = strlen(path);
+    if (stat(path, &stat_buf) != 0 || !S_ISDIR(stat_buf.st_mode) || path_len == 0 ||
+        path[path_len - 1] == '/') {
+        return 0;
+    }
+    char *member_name = malloc(path_len + 2);
+    if (member_name == NULL) {
+        perror("Failed to allocate member name");
+        return 0;
+    }
+    memcpy(member_name, path, path_len);
+    memcpy(member_name + path_len, "/", 2);
+    int archived = file_list_contains(files_in_archive, member_name);
+    free(member_name);
+    return archived;
+}
+
 int main(int argc, char **argv) {
     if (argc < 4) {
-        printf("Usage: %s -c|a|t|u|x -f ARCHIVE [FILE...]\n", argv[0]);
+        printf(USAGE, argv[0]);
         return 0;
     }
 
     file_list_t files;
     file_list_init(&files);
 
-    const char *tar_archive_name = argv[3];
+    // Separating The Options From The File Arguments.
+    // The File Arguments Are Gathered (In Order) Into The Front Of argv + 2, Which Is Safe
+    // Because We Never Write Past The Argument Currently Being Parsed.
+    const char *tar_archive_name = NULL;
+    char **file_args = argv + 2;
+    int num_files = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            tar_archive_name = argv[++i];
+        } else if (strcmp(argv[i], "--buffer-size") == 0 && i + 1 < argc) {
+            if (parse_size(argv[++i], &minitar_opts.buffer_size) != 0) {
+                printf("Invalid buffer size: %s (must be a multiple of %d)\n", argv[i],
+                       BLOCK_SIZE);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            if (parse_jobs(argv[++i], &minitar_opts.num_jobs) != 0) {
+                printf("Invalid number of jobs: %s (must be from 1 to %ld)\n", argv[i],
+                       max_jobs());
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--zero-copy") == 0) {
+            minitar_opts.zero_copy = 1;
+        } else if (strcmp(argv[i], "--io-uring") == 0) {
+            minitar_opts.io_uring = 1;
+        } else if (strcmp(argv[i], "--index") == 0) {
+            minitar_opts.write_index = 1;
+        } else if (strcmp(argv[i], "--incremental") == 0) {
+            minitar_opts.incremental = 1;
+        } else if (strcmp(argv[i], "--check-contents") == 0) {
+            minitar_opts.check_contents = 1;
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            minitar_opts.verify_checksums = 1;
+        } else if (strcmp(argv[i], "-S") == 0 || strcmp(argv[i], "--sparse") == 0) {
+            minitar_opts.sparse = 1;
+        } else if (strcmp(argv[i], "-z") == 0 || strcmp(argv[i], "--gzip") == 0) {
+            minitar_opts.compression = COMPRESS_GZIP;
+        } else if (strcmp(argv[i], "--zstd") == 0) {
+            if (!compress_available(COMPRESS_ZSTD)) {
+                printf("minitar was built without zstd support\n");
+                return -1;
+            }
+            minitar_opts.compression = COMPRESS_ZSTD;
+        } else if ((strcmp(argv[i], "--include") == 0 || strcmp(argv[i], "--exclude") == 0) &&
+                   i + 1 < argc) {
+            int exclude = strcmp(argv[i], "--exclude") == 0;
+            if (member_filter_add(&minitar_opts.filter, argv[++i], exclude) != 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            minitar_opts.print_stats = 1;
+        } else {
+            file_args[num_files++] = argv[i];
+        }
+    }
+
+    if (tar_archive_name == NULL) {
+        printf(USAGE, argv[0]);
+        return -1;
+    }
+
+    // An Archive On stdin Or stdout Can Only Be Written Or Read Once, Front To Back, So It
+    // Cannot Be Added To, Rewritten Or Indexed.
+    if (strcmp(tar_archive_name, STDIO_ARCHIVE_NAME) == 0) {
+        if (strcmp(argv[1], "-a") == 0 || strcmp(argv[1], "-u") == 0 ||
+            strcmp(argv[1], "-k") == 0) {
+            printf("-f - only works with -c, -t and -x\n");
+            return -1;
+        }
+        if (minitar_opts.write_index) {
+            printf("--index needs an archive file, not -f -\n");
+            return -1;
+        }
+    }
+
+    // Update And Compact Always Work On Whole Archives, So Patterns Would Be Ignored.
+    if (member_filter_active(&minitar_opts.filter) &&
+        (strcmp(argv[1], "-u") == 0 || strcmp(argv[1], "-k") == 0)) {
+        printf("--include and --exclude only work with -c, -a, -t and -x\n");
+        return -1;
+    }
 
     // Creating A New Archive File With The Name Provided.
     if (strcmp(argv[1], "-c") == 0) {
         // Adding The Files To The List of Files.
-        // Starting From The 4th Argument, as per our Usage.
-        for (int i = 4; i < argc; i++) {
-            if (file_list_add(&files, argv[i]) == -1) {
+        for (int i = 0; i < num_files; i++) {
+            if (file_list_add(&files, file_args[i]) != 0) {
                 perror("Failed to add file to list");
                 file_list_clear(&files);
                 return -1;
@@ -45,8 +217,8 @@ int main(int argc, char **argv) {
         }
 
         // Adding The Files To The List of Files.
-        for (int i = 4; i < argc; i++) {
-            if (file_list_add(&files, argv[i]) == -1) {
+        for (int i = 0; i < num_files; i++) {
+            if (file_list_add(&files, file_args[i]) != 0) {
                 perror("Failed to add file to list");
                 file_list_clear(&files);
                 return -1;
@@ -85,6 +257,15 @@ int main(int argc, char **argv) {
             return -1;
         }
 
+        // Adding The Files To The List of Files.
+        for (int i = 0; i < num_files; i++) {
+            if (file_list_add(&files, file_args[i]) != 0) {
+                perror("Failed to add file to list");
+                file_list_clear(&files);
+                return -1;
+            }
+        }
+
         // Creating A List of Files To Update.
         file_list_t files_to_update;
         file_list_init(&files_to_update);
@@ -99,18 +280,23 @@ int main(int argc, char **argv) {
             perror("Failed to get archive file list");
             file_list_clear(&files_to_update);
             file_list_clear(&files_in_archive);
+            file_list_clear(&files);
             return -1;
         }
 
         // Adding The Files To The List of Files To Update.
-        // Starting From The 4th Argument, as per our Usage.
         // If The Files Do Not Exist In The Archive, We Print An Error.
-        for (int i = 4; i < argc; i++) {
-            if (file_list_contains(&files_in_archive, argv[i])) {
-                if (file_list_add(&files_to_update, argv[i]) == -1) {
+        // An Incremental Update Walks Directories, So One May Be Named Without The Trailing
+        // Slash Of Its Member.
+        for (node_t *curr_file = files.head; curr_file != NULL; curr_file = curr_file->next) {
+            if (file_list_contains(&files_in_archive, curr_file->name) ||
+                (minitar_opts.incremental &&
+                 directory_archived(&files_in_archive, curr_file->name))) {
+                if (file_list_add(&files_to_update, curr_file->name) != 0) {
                     perror("Failed to add file to list");
                     file_list_clear(&files_to_update);
                     file_list_clear(&files_in_archive);
+                    file_list_clear(&files);
                     return -1;
                 }
             } else {
@@ -119,17 +305,51 @@ int main(int argc, char **argv) {
                     "archive \n");
                 file_list_clear(&files_to_update);
                 file_list_clear(&files_in_archive);
+                file_list_clear(&files);
                 return -1;
             }
         }
 
+        // For An Incremental Update, Directories Are Walked As -c Would, And Only Files That
+        // Changed Since They Were Archived Are Appended Again. Files Found Beneath A
+        // Directory That Are Not In The Archive Yet Are New, So They Count As Changed.
+        if (minitar_opts.incremental) {
+            file_list_t files_expanded, files_changed;
+            file_list_init(&files_expanded);
+            file_list_init(&files_changed);
+            if (expand_update_files(&files_to_update, &files_expanded) == -1) {
+                perror("Failed to walk files to update");
+                file_list_clear(&files_expanded);
+                file_list_clear(&files_to_update);
+                file_list_clear(&files_in_archive);
+                file_list_clear(&files);
+                return -1;
+            }
+            int changed_status =
+                get_changed_files(tar_archive_name, &files_expanded, &files_changed);
+            file_list_clear(&files_expanded);
+            if (changed_status == -1) {
+                perror("Failed to compare files with archive");
+                file_list_clear(&files_changed);
+                file_list_clear(&files_to_update);
+                file_list_clear(&files_in_archive);
+                file_list_clear(&files);
+                return -1;
+            }
+            file_list_clear(&files_to_update);
+            files_to_update = files_changed;
+        }
+
         // Checking if the files to update are a subset of the files in the archive.
         // If they are, we append the files to the archive, essentially updating the archive.
-        if (file_list_is_subset(&files_to_update, &files_in_archive)) {
-            if (append_files_to_archive(tar_archive_name, &files_to_update) == -1) {
+        // An Incremental Update May Also Append New Files Found Beneath A Directory.
+        if (minitar_opts.incremental || file_list_is_subset(&files_to_update, &files_in_archive)) {
+            if (files_to_update.size > 0 &&
+                append_files_to_archive(tar_archive_name, &files_to_update) == -1) {
                 perror("Failed to append files to archive");
                 file_list_clear(&files_to_update);
                 file_list_clear(&files_in_archive);
+                file_list_clear(&files);
                 return -1;
             }
         } else {
@@ -137,6 +357,7 @@ int main(int argc, char **argv) {
                 "Error: One or more of the specified files is not already present in archive \n");
             file_list_clear(&files_to_update);
             file_list_clear(&files_in_archive);
+            file_list_clear(&files);
             return -1;
         }
 
@@ -146,29 +367,59 @@ int main(int argc, char **argv) {
     }
     // Extracting The Files From The Archive.
     else if (strcmp(argv[1], "-x") == 0) {
-        // Checking If The Archive Exists.
-        if (access(tar_archive_name, F_OK) == -1) {
+        // Checking If The Archive Exists (stdin Always Does).
+        if (strcmp(tar_archive_name, STDIO_ARCHIVE_NAME) != 0 &&
+            access(tar_archive_name, F_OK) == -1) {
             perror("Archive does not exist");
             file_list_clear(&files);
             return -1;
         }
 
+        // Only The Files Named (If Any) Are Extracted.
+        for (int i = 0; i < num_files; i++) {
+            if (file_list_add(&files, file_args[i]) != 0) {
+                perror("Failed to add file to list");
+                file_list_clear(&files);
+                return -1;
+            }
+        }
+
         // Extracting The Files From The Archive.
-        if (extract_files_from_archive(tar_archive_name) == -1) {
+        if (extract_files_from_archive(tar_archive_name, &files) == -1) {
             perror("Failed to extract archive");
             file_list_clear(&files);
             return -1;
         }
     }
+    // Compacting The Archive Down To The Newest Version Of Each File.
+    else if (strcmp(argv[1], "-k") == 0) {
+        // Checking If The Archive Exists.
+        if (access(tar_archive_name, F_OK) == -1) {
+            perror("Archive does not exist");
+            file_list_clear(&files);
+            return -1;
+        }
+
+        if (compact_archive(tar_archive_name) == -1) {
+            perror("Failed to compact archive");
+            file_list_clear(&files);
+            return -1;
+        }
+    }
     // Else It's An Invalid Command.
     // And We Print The Usage.
     else {
         printf("Invalid Command\n");
-        printf("Usage: %s -c|a|t|u|x -f ARCHIVE [FILE...]\n", argv[0]);
+        printf(USAGE, argv[0]);
         file_list_clear(&files);
         return -1;
     }
 
+    if (minitar_opts.print_stats) {
+        print_stats(stderr);
+    }
+
     file_list_clear(&files);
+    member_filter_clear(&minitar_opts.filter);
     return 0;
 }
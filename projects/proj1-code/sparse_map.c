@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include "sparse_map.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE 512
+#define INITIAL_SEGMENTS 16
+// Longest decimal 64-bit number plus its newline
+#define MAX_NUMBER_LEN 21
+
+void sparse_map_init(sparse_map_t *map) {
+    memset(map, 0, sizeof(sparse_map_t));
+}
+
+// Appends A Segment To The Map, Growing It As Needed.
+static int add_segment(sparse_map_t *map, uint64_t offset, uint64_t length) {
+    if (map->count == map->capacity) {
+        size_t capacity = map->capacity == 0 ? INITIAL_SEGMENTS : map->capacity * 2;
+        sparse_segment_t *segments = realloc(map->segments, capacity * sizeof(sparse_segment_t));
+        if (segments == NULL) {
+            perror("Failed to allocate sparse map");
+            return -1;
+        }
+        map->segments = segments;
+        map->capacity = capacity;
+    }
+    map->segments[map->count].offset = offset;
+    map->segments[map->count].length = length;
+    map->count++;
+    map->data_size += length;
+    return 0;
+}
+
+int sparse_map_scan(sparse_map_t *map, int fd, uint64_t file_size) {
+    map->count = 0;
+    map->real_size = file_size;
+    map->data_size = 0;
+
+    // Hop From Each Run Of Data To The Hole After It; The File Is Never Read Here.
+    uint64_t pos = 0;
+    while (pos < file_size) {
+        off_t data_start = lseek(fd, pos, SEEK_DATA);
+        if (data_start == -1) {
+            if (errno == ENXIO) {
+                // Nothing But A Hole Is Left.
+                break;
+            }
+            if (errno == EINVAL || errno == EOPNOTSUPP) {
+                // The File System Cannot Report Holes, So Store The File As Is.
+                map->data_size = file_size;
+                break;
+            }
+            perror("Failed to find data in file");
+            return -1;
+        }
+        if ((uint64_t) data_start >= file_size) {
+            break;
+        }
+        off_t hole_start = lseek(fd, data_start, SEEK_HOLE);
+        if (hole_start == -1) {
+            perror("Failed to find hole in file");
+            return -1;
+        }
+        // Only The Size Taken From fstat Is Archived, Even If The File Has Since Grown.
+        uint64_t data_end = (uint64_t) hole_start < file_size ? hole_start : file_size;
+        if (add_segment(map, data_start, data_end - data_start) != 0) {
+            return -1;
+        }
+        pos = data_end;
+    }
+
+    if (lseek(fd, 0, SEEK_SET) == -1) {
+        perror("Failed to seek in file");
+        return -1;
+    }
+    if (map->data_size == file_size) {
+        map->count = 0;
+        map->data_size = 0;
+        return 0;
+    }
+
+    // Like GNU tar, A File Ending In A Hole Gets An Empty Segment At Its End.
+    if (map->count == 0 || map->segments[map->count - 1].offset +
+                                   map->segments[map->count - 1].length <
+                               file_size) {
+        if (add_segment(map, file_size, 0) != 0) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+// Returns The Number Of Bytes Needed To Write 'value' In Decimal, Plus A Newline.
+static size_t number_len(uint64_t value) {
+    size_t len = 2;
+    while (value >= 10) {
+        value /= 10;
+        len++;
+    }
+    return len;
+}
+
+size_t sparse_map_encoded_size(const sparse_map_t *map) {
+    size_t size = number_len(map->count);
+    for (size_t i = 0; i < map->count; i++) {
+        size += number_len(map->segments[i].offset) + number_len(map->segments[i].length);
+    }
+    return (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+}
+
+void sparse_map_encode(const sparse_map_t *map, char *data) {
+    size_t encoded_size = sparse_map_encoded_size(map);
+    char number[MAX_NUMBER_LEN + 1];
+    size_t pos = snprintf(data, MAX_NUMBER_LEN + 1, "%zu\n", map->count);
+    for (size_t i = 0; i < map->count; i++) {
+        // Numbers Go Through A Scratch Buffer, As The Last One May End Flush With The Map.
+        int len = snprintf(number, sizeof(number), "%llu\n",
+                           (unsigned long long) map->segments[i].offset);
+        memcpy(data + pos, number, len);
+        pos += len;
+        len = snprintf(number, sizeof(number), "%llu\n",
+                       (unsigned long long) map->segments[i].length);
+        memcpy(data + pos, number, len);
+        pos += len;
+    }
+    memset(data + pos, 0, encoded_size - pos);
+}
+
+// Reads One Newline-Terminated Decimal Number Starting At '*pos'.
+// Returns 1 With '*value' Set, 0 If The Data Ends First, Or -1 If It Is Malformed.
+static int read_number(const char *data, size_t size, size_t *pos, uint64_t *value) {
+    *value = 0;
+    size_t start = *pos;
+    for (size_t i = start; i < size; i++) {
+        if (data[i] == '\n' && i > start) {
+            *pos = i + 1;
+            return 1;
+        }
+        if (data[i] < '0' || data[i] > '9' || *value > (UINT64_MAX - 9) / 10) {
+            return -1;
+        }
+        *value = *value * 10 + (data[i] - '0');
+    }
+    return 0;
+}
+
+ssize_t sparse_map_decode(sparse_map_t *map, const char *data, size_t size, uint64_t real_size) {
+    map->count = 0;
+    map->real_size = real_size;
+    map->data_size = 0;
+
+    size_t pos = 0;
+    uint64_t num_segments;
+    int status = read_number(data, size, &pos, &num_segments);
+    uint64_t end_of_last = 0;
+    for (uint64_t i = 0; status == 1 && i < num_segments; i++) {
+        uint64_t offset, length;
+        status = read_number(data, size, &pos, &offset);
+        if (status == 1) {
+            status = read_number(data, size, &pos, &length);
+        }
+        if (status != 1) {
+            break;
+        }
+
+        // Segments Must Come In Order, Without Overlapping, And Stay Within The File.
+        if (offset < end_of_last || offset > real_size || length > real_size - offset) {
+            status = -1;
+        } else if (add_segment(map, offset, length) != 0) {
+            return -1;
+        }
+        end_of_last = offset + length;
+    }
+
+    if (status == -1) {
+        fprintf(stderr, "Failed to read from tar archive: malformed sparse map\n");
+        return -1;
+    }
+    if (status == 0) {
+        return 0;
+    }
+    return (pos + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+}
+
+void sparse_map_clear(sparse_map_t *map) {
+    free(map->segments);
+    sparse_map_init(map);
+}
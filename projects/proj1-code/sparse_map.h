@@ -0,0 +1,50 @@
+#ifndef _SPARSE_MAP_H
+#define _SPARSE_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// One run of data in a sparse file; everything between two runs is a hole
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+} sparse_segment_t;
+
+// Where the data of a sparse file lies, in file order.
+// A sparse member is stored as this map (GNU sparse format 1.0: decimal numbers, one per
+// line, padded out to whole blocks) followed by the data of each segment, back to back, so
+// the holes take up no room in the archive.
+typedef struct {
+    sparse_segment_t *segments;
+    size_t count;           // 0 for a file without holes
+    size_t capacity;
+    uint64_t real_size;     // Size of the file, holes included
+    uint64_t data_size;     // Bytes of data across all the segments
+} sparse_map_t;
+
+// Initialize a new, empty map
+void sparse_map_init(sparse_map_t *map);
+
+// Find the data segments of the file open as 'fd', 'file_size' bytes long, with
+// SEEK_DATA/SEEK_HOLE. The file offset of 'fd' is left at 0.
+// Returns 1 if the file has holes, 0 if it has none (or the file system cannot tell), in
+// which case the map is left empty, or -1 if an error occurs
+int sparse_map_scan(sparse_map_t *map, int fd, uint64_t file_size);
+
+// Returns the number of bytes the encoded map takes up, padded out to whole blocks
+size_t sparse_map_encoded_size(const sparse_map_t *map);
+
+// Write the map into 'data', which must hold sparse_map_encoded_size(map) bytes
+void sparse_map_encode(const sparse_map_t *map, char *data);
+
+// Read a map from the first 'size' bytes of a member's contents, for a file of
+// 'real_size' bytes
+// Returns the number of bytes the map takes up, 0 if it runs past 'size' (so more of the
+// contents are needed), or -1 if it is malformed
+ssize_t sparse_map_decode(sparse_map_t *map, const char *data, size_t size, uint64_t real_size);
+
+// Free any memory associated with the map and leave it empty
+void sparse_map_clear(sparse_map_t *map);
+
+#endif    // _SPARSE_MAP_H
@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include "tree_walk.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define QUEUE_CAPACITY 1024
+#define INITIAL_DIR_ENTRIES 64
+
+// Name and type of one entry read from a directory
+typedef struct {
+    char *name;
+    unsigned char type;    // DT_* constant from the dirent
+} dir_entry_t;
+
+// Hands a copy of 'path' to the consumers, waiting while the queue is full.
+// Returns 0 on success or -1 if the walk was stopped or an error occurs
+static int walk_push(tree_walk_t *walk, const char *path) {
+    char *path_copy = strdup(path);
+    if (path_copy == NULL) {
+        perror("Failed to allocate path");
+        return -1;
+    }
+
+    pthread_mutex_lock(&walk->lock);
+    while (!walk->abort && walk->count == walk->capacity) {
+        pthread_cond_wait(&walk->changed, &walk->lock);
+    }
+    if (walk->abort) {
+        pthread_mutex_unlock(&walk->lock);
+        free(path_copy);
+        return -1;
+    }
+    walk_entry_t *entry = &walk->queue[(walk->head + walk->count) % walk->capacity];
+    entry->path = path_copy;
+    entry->seq = walk->num_queued++;
+    walk->count++;
+    pthread_cond_broadcast(&walk->changed);
+    pthread_mutex_unlock(&walk->lock);
+    return 0;
+}
+
+// Returns 1 If The Walk's Filter Leaves Out 'path', A Directory If 'is_dir' Is Set.
+// A Directory Is Only Left Out When Excluded, As Files Beneath It May Still Be Included.
+static int walk_skips(const tree_walk_t *walk, const char *path, int is_dir) {
+    if (walk->filter == NULL) {
+        return 0;
+    }
+    return is_dir ? member_filter_excluded(walk->filter, path)
+                  : !member_filter_match(walk->filter, path);
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const dir_entry_t *) a)->name, ((const dir_entry_t *) b)->name);
+}
+
+// Reads every entry of the directory open as 'dir' into a name-sorted array
+// Returns the number of entries, or -1 if an error occurs
+static ssize_t read_dir_entries(DIR *dir, const char *path, dir_entry_t **entries_out) {
+    size_t count = 0;
+    size_t capacity = INITIAL_DIR_ENTRIES;
+    dir_entry_t *entries = malloc(capacity * sizeof(dir_entry_t));
+    if (entries == NULL) {
+        perror("Failed to allocate directory entries");
+        return -1;
+    }
+
+    struct dirent *dirent;
+    errno = 0;
+    while ((dirent = readdir(dir)) != NULL) {
+        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+            continue;
+        }
+        if (count == capacity) {
+            dir_entry_t *grown = realloc(entries, 2 * capacity * sizeof(dir_entry_t));
+            if (grown == NULL) {
+                break;
+            }
+            entries = grown;
+            capacity *= 2;
+        }
+        entries[count].name = strdup(dirent->d_name);
+        if (entries[count].name == NULL) {
+            break;
+        }
+        entries[count].type = dirent->d_type;
+        count++;
+        errno = 0;
+    }
+    if (errno != 0) {
+        char err_msg[PATH_MAX + 32];
+        snprintf(err_msg, sizeof(err_msg), "Failed to read directory %s", path);
+        perror(err_msg);
+        for (size_t i = 0; i < count; i++) {
+            free(entries[i].name);
+        }
+        free(entries);
+        return -1;
+    }
+
+    qsort(entries, count, sizeof(dir_entry_t), compare_entries);
+    *entries_out = entries;
+    return count;
+}
+
+// Opens the directory at 'path', with 'open_flags' added to the flags for open, and reads
+// every entry of it into a name-sorted array
+// Returns the number of entries, or -1 if an error occurs
+static ssize_t read_dir_at(const char *path, int open_flags, dir_entry_t **entries_out) {
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | open_flags);
+    DIR *dir = dir_fd == -1 ? NULL : fdopendir(dir_fd);
+    if (dir == NULL) {
+        char err_msg[PATH_MAX + 32];
+        snprintf(err_msg, sizeof(err_msg), "Failed to open directory %s", path);
+        perror(err_msg);
+        if (dir_fd != -1) {
+            close(dir_fd);
+        }
+        return -1;
+    }
+    ssize_t num_entries = read_dir_entries(dir, path, entries_out);
+    closedir(dir);
+    return num_entries;
+}
+
+// Queues everything beneath the directory whose path is held in 'path' (a PATH_MAX
+// buffer, 'path_len' bytes long), opened with 'open_flags' added to the flags for open.
+// The directory is read in full and closed before descending, so the walk keeps only one
+// directory open at a time however deep the tree goes.
+// Returns 0 on success or -1 if an error occurs
+static int walk_dir(tree_walk_t *walk, char *path, size_t path_len, int open_flags) {
+    dir_entry_t *entries;
+    ssize_t num_entries = read_dir_at(path, open_flags, &entries);
+    if (num_entries < 0) {
+        return -1;
+    }
+
+    // Children Are Joined With A Single Slash, Even If The Directory Was Given As "dir/".
+    size_t prefix_len = path_len;
+    if (prefix_len > 0 && path[prefix_len - 1] != '/') {
+        path[prefix_len++] = '/';
+    }
+
+    int status = 0;
+    for (ssize_t i = 0; i < num_entries && status == 0; i++) {
+        size_t name_len = strlen(entries[i].name);
+        if (prefix_len + name_len >= PATH_MAX) {
+            fprintf(stderr, "Path too long: %.*s%s\n", (int) prefix_len, path, entries[i].name);
+            status = -1;
+            break;
+        }
+        memcpy(path + prefix_len, entries[i].name, name_len + 1);
+
+        // Only Look The Entry Up If The File System Did Not Say What It Is.
+        unsigned char type = entries[i].type;
+        if (type == DT_UNKNOWN) {
+            struct stat stat_buf;
+            if (lstat(path, &stat_buf) != 0) {
+                perror("Failed to stat file");
+                status = -1;
+                break;
+            }
+            type = S_ISDIR(stat_buf.st_mode) ? DT_DIR : S_ISREG(stat_buf.st_mode) ? DT_REG : 0;
+        }
+
+        if ((type == DT_REG || type == DT_DIR) && walk_skips(walk, path, type == DT_DIR)) {
+            continue;
+        }
+        if (type == DT_REG) {
+            status = walk_push(walk, path);
+        } else if (type == DT_DIR) {
+            status = walk_push(walk, path);
+            if (status == 0) {
+                status = walk_dir(walk, path, prefix_len + name_len, O_NOFOLLOW);
+            }
+        } else {
+            // Links, Devices And The Like Have No Member Type Here.
+            fprintf(stderr, "Skipping %s: not a regular file or directory\n", path);
+        }
+    }
+
+    path[path_len] = '\0';
+    for (ssize_t i = 0; i < num_entries; i++) {
+        free(entries[i].name);
+    }
+    free(entries);
+    return status;
+}
+
+// Walker Thread: Queues Each Root, Descending Into The Ones That Are Directories.
+static void *walk_roots(void *arg) {
+    tree_walk_t *walk = arg;
+    char path[PATH_MAX];
+
+    int status = 0;
+    for (node_t *root = walk->roots->head; root != NULL && status == 0; root = root->next) {
+        // Anything That Is Not A Directory (Even A Missing File) Is Queued As Given, And
+        // Reported By Whoever Opens It.
+        struct stat stat_buf;
+        int is_dir = stat(root->name, &stat_buf) == 0 && S_ISDIR(stat_buf.st_mode);
+        if (walk_skips(walk, root->name, is_dir)) {
+            continue;
+        }
+        status = walk_push(walk, root->name);
+        if (status != 0 || !is_dir) {
+            continue;
+        }
+
+        size_t path_len = strlen(root->name);
+        if (path_len >= PATH_MAX) {
+            fprintf(stderr, "Path too long: %s\n", root->name);
+            status = -1;
+            break;
+        }
+        memcpy(path, root->name, path_len + 1);
+        status = walk_dir(walk, path, path_len, 0);
+    }
+
+    pthread_mutex_lock(&walk->lock);
+    walk->done = 1;
+    walk->failed = status != 0 && !walk->abort;
+    pthread_cond_broadcast(&walk->changed);
+    pthread_mutex_unlock(&walk->lock);
+    return NULL;
+}
+
+int tree_walk_start(tree_walk_t *walk, const file_list_t *roots, const member_filter_t *filter) {
+    memset(walk, 0, sizeof(tree_walk_t));
+    walk->roots = roots;
+    walk->filter = filter;
+    walk->capacity = QUEUE_CAPACITY;
+    walk->queue = malloc(walk->capacity * sizeof(walk_entry_t));
+    if (walk->queue == NULL) {
+        perror("Failed to allocate walk queue");
+        return -1;
+    }
+    pthread_mutex_init(&walk->lock, NULL);
+    pthread_cond_init(&walk->changed, NULL);
+
+    int err = pthread_create(&walk->thread, NULL, walk_roots, walk);
+    if (err != 0) {
+        errno = err;
+        perror("Failed to start walker thread");
+        pthread_cond_destroy(&walk->changed);
+        pthread_mutex_destroy(&walk->lock);
+        free(walk->queue);
+        return -1;
+    }
+    return 0;
+}
+
+int tree_walk_next(tree_walk_t *walk, walk_entry_t *entry) {
+    pthread_mutex_lock(&walk->lock);
+    while (walk->count == 0 && !walk->done && !walk->abort) {
+        pthread_cond_wait(&walk->changed, &walk->lock);
+    }
+
+    int status;
+    if (walk->count > 0) {
+        *entry = walk->queue[walk->head];
+        walk->head = (walk->head + 1) % walk->capacity;
+        walk->count--;
+        walk->num_taken++;
+        status = 1;
+        pthread_cond_broadcast(&walk->changed);
+    } else {
+        entry->path = NULL;
+        entry->seq = walk->num_taken;
+        status = walk->failed ? -1 : 0;
+    }
+    pthread_mutex_unlock(&walk->lock);
+    return status;
+}
+
+void tree_walk_stop(tree_walk_t *walk) {
+    pthread_mutex_lock(&walk->lock);
+    walk->abort = 1;
+    pthread_cond_broadcast(&walk->changed);
+    pthread_mutex_unlock(&walk->lock);
+}
+
+int tree_walk_finish(tree_walk_t *walk) {
+    tree_walk_stop(walk);
+    pthread_join(walk->thread, NULL);
+
+    for (size_t i = 0; i < walk->count; i++) {
+        free(walk->queue[(walk->head + i) % walk->capacity].path);
+    }
+    int status = walk->failed ? -1 : 0;
+    pthread_cond_destroy(&walk->changed);
+    pthread_mutex_destroy(&walk->lock);
+    free(walk->queue);
+    return status;
+}
@@ -0,0 +1,61 @@
+#ifndef _TREE_WALK_H
+#define _TREE_WALK_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "file_list.h"
+#include "member_filter.h"
+
+// One path produced by a tree walk
+typedef struct {
+    // Path to archive, allocated with malloc and owned by whoever takes the entry
+    char *path;
+    // Position of the entry in the walk, starting from 0
+    // When tree_walk_next reports the end of the walk, this holds the number of entries
+    size_t seq;
+} walk_entry_t;
+
+// Walk over the paths given to create or append, expanding every directory among them
+// into the directory itself followed by everything beneath it (depth first, with the
+// entries of each directory in name order, so the walk is the same every time).
+// Paths a filter excludes are left out, along with everything beneath them, and files its
+// include patterns do not match are skipped; directories are still walked for them.
+// The walk runs on its own thread and hands paths over through a bounded queue, so
+// archiving can start long before a large tree has been fully traversed.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    walk_entry_t *queue;    // Ring buffer of paths waiting to be taken
+    size_t capacity;
+    size_t head;
+    size_t count;
+    size_t num_queued;      // Entries the walker has produced so far
+    size_t num_taken;       // Entries handed out by tree_walk_next
+    int done;               // Set once the walker has queued its last entry
+    int failed;             // Set if the walker gave up on an error
+    int abort;              // Set by tree_walk_stop to end the walk early
+    const file_list_t *roots;
+    const member_filter_t *filter;
+    pthread_t thread;
+} tree_walk_t;
+
+// Starts walking the paths in 'roots', keeping only those passing 'filter' (unless it is
+// NULL). Both must stay alive until tree_walk_finish.
+// Returns 0 on success or -1 if an error occurs
+int tree_walk_start(tree_walk_t *walk, const file_list_t *roots, const member_filter_t *filter);
+
+// Takes the next path of the walk, in walk order, waiting for the walker if needed
+// Safe to call from several threads at once
+// Returns 1 with 'entry' filled in, 0 at the end of the walk or -1 if the walk failed
+int tree_walk_next(tree_walk_t *walk, walk_entry_t *entry);
+
+// Ends the walk early: the walker stops queueing paths, and tree_walk_next no longer waits
+// for it once the queue is empty
+void tree_walk_stop(tree_walk_t *walk);
+
+// Stops the walker if it is still running and releases the walk
+// Returns 0 on success or -1 if the walker failed
+int tree_walk_finish(tree_walk_t *walk);
+
+#endif    // _TREE_WALK_H